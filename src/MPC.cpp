@@ -1,172 +1,645 @@
 #include "MPC.h"
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
 #include "Eigen-3.3/Eigen/Core"
+#include "arena.h"
+#include "smoothing.h"
+#include "thread_pool.h"
+#include "vehicle_model.h"
 
 using CppAD::AD;
 
-// TODO: Set the timestep length and duration
-size_t N = 25;
-double dt = 0.05;
+typedef CPPAD_TESTVECTOR(double) Dvector;
 
-// This value assumes the model presented in the classroom is used.
-//
-// It was obtained by measuring the radius formed by running the vehicle in the
-// simulator around in a circle with a constant steering angle and velocity on a
-// flat terrain.
-//
-// Lf was tuned until the the radius formed by the simulating the model
-// presented in the classroom matched the previous radius.
-//
-// This is the length from front to CoG that has a similar radius.
-const double Lf = 2.67;
+// Time (seconds) kept free after the solver returns to assemble the result
+const double deadline_margin = 0.002;
+
+// Shortest time (seconds) a start is given; Ipopt rejects a zero limit and
+// could not do a single iteration in less
+const double min_solve_budget = 1e-4;
 
-// Convert reference speed to meters per second
-const double ref_v = 70 * 0.44704;
+// Ipopt option limiting a solve. Ipopt 3.14 added a wall-clock limit; older
+// versions only limit the CPU time of the whole process, which runs faster
+// than the wall clock while starts solve concurrently.
+#if IPOPT_VERSION_MAJOR > 3 || (IPOPT_VERSION_MAJOR == 3 && IPOPT_VERSION_MINOR >= 14)
+const char* const time_limit_option = "max_wall_time";
+#else
+const char* const time_limit_option = "max_cpu_time";
+#endif
 
 // The solver takes all the state variables and actuator
 // variables in a singular vector. Thus, we should to establish
 // when one variable starts and another ends to make our lifes easier.
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
+struct Layout {
+  size_t N;
+  // Full state entries (see vehicle_model.h) that are decision variables, in
+  // order: those the model propagates, and cte and epsi with error states
+  vector<size_t> states;
+  size_t n_states;
+  // Entries the model propagates
+  size_t n_model_states;
+  bool error_states;
+  // Number of distinct actuator values; fewer than N - 1 when moves are blocked
+  size_t M;
+  // Duration of every interval t -> t + 1 and the actuator index applied over it
+  vector<double> dts;
+  vector<size_t> blocks;
+  // Timesteps whose states are decision variables (shooting nodes), and the
+  // node index of every timestep (-1 when its state is a rolled-out expression)
+  vector<size_t> nodes;
+  vector<long> node_of;
+
+  size_t delta_start;
+  size_t a_start;
+
+  size_t n_vars;
+  size_t n_constraints;
+
+  Layout(const Horizon& h, const Formulation& f, const ModelConfig& model) {
+    if (h.segments.empty()) {
+      for (size_t t = 0; t + 1 < h.N; ++t) {
+        dts.push_back(h.dt);
+        blocks.push_back(t);
+      }
+    } else {
+      size_t block = 0;
+      for (const GridSegment& seg : h.segments) {
+        for (size_t i = 0; i < seg.steps; ++i) {
+          if (i > 0 && i % seg.hold == 0) {
+            ++block;
+          }
+          dts.push_back(seg.dt);
+          blocks.push_back(block);
+        }
+        ++block;
+      }
+    }
+    N = dts.size() + 1;
+    M = blocks.empty() ? 0 : blocks.back() + 1;
+
+    n_model_states = model_state_count(model);
+    error_states = f.error_states;
+    for (size_t j = 0; j < n_model_states; ++j) {
+      states.push_back(model_state(model, j));
+    }
+    if (error_states) {
+      states.push_back(4);
+      states.push_back(5);
+    }
+    sort(states.begin(), states.end());
+    n_states = states.size();
+
+    // The simultaneous transcription keeps every state, including the initial
+    // one pinned by its constraint. Shooting transcriptions start from the
+    // known initial state and only keep a state every `shooting_interval`
+    // timesteps, or none at all.
+    node_of.assign(N, -1);
+    for (size_t t = 0; t < N; ++t) {
+      bool node = false;
+      switch (f.transcription) {
+        case Formulation::SIMULTANEOUS:
+          node = true;
+          break;
+        case Formulation::MULTIPLE_SHOOTING:
+          node = t > 0 && t % max(f.shooting_interval, size_t(1)) == 0;
+          break;
+        case Formulation::SINGLE_SHOOTING:
+          break;
+      }
+      if (node) {
+        node_of[t] = nodes.size();
+        nodes.push_back(t);
+      }
+    }
+    size_t n_nodes = nodes.size();
+
+    delta_start = n_states * n_nodes;
+    a_start = delta_start + M;
+
+    // For example: If the state is a 4 element vector, the actuators is a 2
+    // element vector and there are 10 timesteps. The number of variables is:
+    //
+    // 4 * 10 + 2 * 9
+    n_vars = n_states * n_nodes + 2 * M;
+    n_constraints = n_states * n_nodes;
+  }
+
+  // Offset of decision state j, full state entry states[j]
+  size_t state_start(size_t j) const { return j * nodes.size(); }
+
+  // Actuator index in effect at timestep t (the last one for the final state)
+  size_t block(size_t t) const { return blocks[min(t, N - 2)]; }
+
+  // The variables hold the whole trajectory, laid out as in PlanTrajectory
+  bool dense() const {
+    return n_model_states == 4 && error_states && nodes.size() == N && M + 1 == N;
+  }
+
+  // Number of whole intervals closest to the given duration
+  size_t intervals(double duration) const {
+    size_t n = 0;
+    double elapsed = 0.0;
+    while (n < dts.size() && elapsed + dts[n] / 2 < duration) {
+      elapsed += dts[n++];
+    }
+    return n;
+  }
+};
+
+// Most initial guesses a solve starts from (see MultiStart)
+const size_t max_starts = 4;
+
+// Per-horizon state kept across ticks, one entry per distinct grid and
+// formulation so that switching between horizons does not rebuild anything.
+struct HorizonEntry {
+  Layout layout;
+  // Trajectory of the last accepted solve, used for warm starts and as the
+  // fallback plan, the time it was computed and the number of intervals it
+  // has since been advanced by
+  PlanTrajectory plan;
+  chrono::steady_clock::time_point last_time;
+  size_t plan_shift;
+  // Average wall-clock solve time for this horizon (seconds)
+  double solve_time;
+  unsigned long solves;
+  // Number of ticks served, solved or not
+  unsigned long ticks;
+
+  // Buffers sized once for this horizon and reused by every tick
+  vector<Dvector> starts;
+  vector<CppAD::ipopt::solve_result<Dvector> > solutions;
+  vector<string> options;
+
+  // Variable and constraint bounds, built for `limits`. Only the initial
+  // state slots of the constraint bounds change between ticks.
+  ActuatorLimits limits;
+  bool has_bounds;
+  Dvector vars_lowerbound;
+  Dvector vars_upperbound;
+  Dvector constraints_lowerbound;
+  Dvector constraints_upperbound;
+  vector<double> shifted;
+  // Reference speed of every timestep for the tick in progress
+  vector<double> ref_v;
+
+  HorizonEntry(const Horizon& h, const Formulation& f, const ModelConfig& model)
+      : layout(h, f, model), plan_shift(0), solve_time(0.0), solves(0), ticks(0),
+        starts(max_starts, Dvector(layout.n_vars)), solutions(max_starts),
+        options(max_starts), has_bounds(false),
+        vars_lowerbound(layout.n_vars), vars_upperbound(layout.n_vars),
+        constraints_lowerbound(layout.n_constraints),
+        constraints_upperbound(layout.n_constraints), ref_v(layout.N) {
+    plan.Reserve(layout.N);
+    shifted.reserve(layout.n_vars);
+    for (string& o : options) {
+      o.reserve(256);
+    }
+  }
+
+  // Moves the plan in place to `shift` intervals past the time it was
+  // computed, unless it is already further along.
+  void AdvancePlan(size_t shift) {
+    if (shift > plan_shift) {
+      plan.Shift(shift - plan_shift);
+      plan_shift = shift;
+    }
+  }
+
+  void BuildBounds(const ActuatorLimits& limits) {
+    const Layout& l = layout;
+    this->limits = limits;
+    has_bounds = true;
+
+    // non-actuator lower and upper bound values should be close to 0
+    for (size_t i = 0; i < l.delta_start; i++) {
+      vars_lowerbound[i] = -1.0e19;
+      vars_upperbound[i] = 1.0e19;
+    }
+
+    // The upper and lower limits of delta are set to -25 and 25
+    // degrees (values in radians).
+    for (size_t i = l.delta_start; i < l.a_start; i++) {
+      vars_lowerbound[i] = -limits.max_steer;
+      vars_upperbound[i] = limits.max_steer;
+    }
+
+    // Acceleration/decceleration upper and lower limits.
+    for (size_t i = l.a_start; i < l.n_vars; i++) {
+      vars_lowerbound[i] = limits.min_throttle;
+      vars_upperbound[i] = limits.max_throttle;
+    }
+
+    // Lower and upper limits for the constraints
+    // Should be 0 besides initial state, which is set every tick.
+    for (size_t i = 0; i < l.n_constraints; i++) {
+      constraints_lowerbound[i] = 0;
+      constraints_upperbound[i] = 0;
+    }
+  }
+};
+
+struct MPC::Cache {
+  // Keyed by the formulation and grid description with durations in
+  // microseconds, so float noise cannot split entries
+  map<vector<long>, HorizonEntry> entries;
+  // Key being looked up, kept to reuse its storage
+  vector<long> key;
+
+  // Scratch memory of the tick in progress
+  Arena arena;
+
+  Smoother smoother;
+
+  // The layout only depends on the model through its states, so the
+  // integrator shares the entry of its model
+  HorizonEntry& get(const Horizon& h, const Formulation& f, const ModelConfig& model) {
+    key.clear();
+    key.push_back(model.type);
+    key.push_back(f.error_states);
+    key.push_back(f.transcription);
+    key.push_back(f.shooting_interval);
+    key.push_back(h.N);
+    key.push_back(lround(h.dt * 1e6));
+    for (const GridSegment& seg : h.segments) {
+      key.push_back(seg.steps);
+      key.push_back(lround(seg.dt * 1e6));
+      key.push_back(seg.hold);
+    }
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+      it = entries.insert(make_pair(key, HorizonEntry(h, f, model))).first;
+    }
+    return it->second;
+  }
+};
+
+Horizon make_blocked_horizon(const vector<GridSegment>& segments) {
+  Horizon h;
+  h.N = 1;
+  h.dt = segments.empty() ? 0.0 : segments[0].dt;
+  for (const GridSegment& seg : segments) {
+    h.N += seg.steps;
+  }
+  h.segments = segments;
+  return h;
+}
+
+// Predicted states and actuators over the horizon, one array per quantity.
+// The states have N entries and the actuators one per block.
+// The allocator lets per-tick trajectories live in the solver's arena.
+template <typename Scalar, typename Alloc = allocator<Scalar> >
+struct Trajectory {
+  typedef vector<Scalar, Alloc> Vector;
+  Vector x, y, psi, v, cte, epsi;
+  // Dynamic model only, empty otherwise
+  Vector vy, r;
+  Vector delta, a;
+
+  explicit Trajectory(const Layout& l, const Alloc& alloc = Alloc())
+      : x(l.N, Scalar(), alloc), y(l.N, Scalar(), alloc), psi(l.N, Scalar(), alloc),
+        v(l.N, Scalar(), alloc), cte(l.N, Scalar(), alloc), epsi(l.N, Scalar(), alloc),
+        vy(l.n_model_states > 4 ? l.N : 0, Scalar(), alloc),
+        r(l.n_model_states > 4 ? l.N : 0, Scalar(), alloc),
+        delta(l.M, Scalar(), alloc), a(l.M, Scalar(), alloc) {}
+
+  // Full state entry k
+  Vector& state(size_t k) {
+    Vector* states[full_states] = {&x, &y, &psi, &v, &cte, &epsi, &vy, &r};
+    return *states[k];
+  }
+};
+
+typedef Trajectory<double, ArenaAllocator<double> > ScratchTrajectory;
+
+// Fills the actuators of `vars` from those of `plan`, every block taking the
+// actuation planned for its first interval.
+template <typename Vector>
+void plan_actuators(const Layout& l, const PlanTrajectory& plan, Vector& vars) {
+  PlanTrajectory::View delta = plan.delta();
+  PlanTrajectory::View a = plan.a();
+  size_t t = 0;
+  for (size_t b = 0; b < l.M; ++b) {
+    while (l.blocks[t] != b) {
+      ++t;
+    }
+    vars[l.delta_start + b] = delta[t];
+    vars[l.a_start + b] = a[t];
+  }
+}
+
+// Copies a trajectory into `plan`, one block per quantity, expanding blocked
+// actuators back to one value per interval.
+template <typename Alloc>
+void store_trajectory(const Layout& l, const Trajectory<double, Alloc>& tr,
+                      PlanTrajectory& plan) {
+  plan.Resize(l.N);
+  const vector<double, Alloc>* states[6] = {&tr.x, &tr.y, &tr.psi, &tr.v, &tr.cte, &tr.epsi};
+  for (size_t k = 0; k < 6; ++k) {
+    copy(states[k]->begin(), states[k]->end(), plan.get(PlanTrajectory::Quantity(k)).data());
+  }
+  PlanTrajectory::MutableView delta = plan.delta();
+  PlanTrajectory::MutableView a = plan.a();
+  for (size_t t = 0; t + 1 < l.N; ++t) {
+    delta[t] = tr.delta[l.blocks[t]];
+    a[t] = tr.a[l.blocks[t]];
+  }
+}
+
+// Returns the cost of a trajectory.
+// Templated on the scalar type so that the solver (AD<double>) and the
+// bicycle model rollouts (double) share the exact same cost definition.
+template <typename Scalar, typename Alloc>
+Scalar trajectory_cost(const Layout& l, const Objective& w, const double* ref_v,
+                       const Trajectory<Scalar, Alloc>& tr) {
+  using CppAD::pow;
+  const size_t N = l.N;
+  Scalar cost = 0.0;
+  // First step is to add cte, epsi as well as velocity difference to cost
+  for (unsigned int t = 0; t < N; t++) {
+    cost += w.cte * pow(tr.cte[t], 2);
+    cost += w.cte_steer * pow(tr.cte[t] * tr.delta[l.block(t)], 2);
+    cost += w.epsi * pow(tr.epsi[t], 2);
+    cost += w.speed * pow(tr.v[t] - ref_v[t], 2);
+  }
+
+  // Then we want to minimise the use of actuators for a smoother ride.
+  // A blocked actuator is charged once for every interval it is held over.
+  for (unsigned int t = 0; t < N - 1; t++) {
+    size_t b = l.blocks[t];
+    cost += w.steer * pow(tr.delta[b], 2);
+    cost += w.throttle * pow(tr.a[b], 2);
+    cost += w.throttle_steer * pow(tr.a[b] * tr.delta[b], 2);
+  }
+
+  // Finally. we want to minimise sudden changes between successive states
+  for(unsigned int b = 0; b + 1 < l.M; ++b){
+    cost += w.steer_rate * pow(tr.delta[b + 1] - tr.delta[b], 2);
+    cost += w.throttle_rate * pow(tr.a[b + 1] - tr.a[b], 2);
+  }
+
+  return cost;
+}
+
+// Writes the reference speed of every timestep into ref_v (see
+// SpeedReference).
+void reference_speeds(const Layout& l, const Objective& objective,
+                      const SpeedReference& reference, vector<double>& ref_v) {
+  const vector<double>& speeds = reference.speeds;
+  double distance = 0.0;
+  for (size_t t = 0; t < l.N; ++t) {
+    if (speeds.empty() || reference.ds <= 0.0) {
+      ref_v[t] = objective.ref_v;
+      continue;
+    }
+    double k = distance / reference.ds;
+    size_t i = size_t(k);
+    ref_v[t] = i + 1 < speeds.size() ? speeds[i] + (k - i) * (speeds[i + 1] - speeds[i])
+                                     : speeds.back();
+    if (t + 1 < l.N) {
+      distance += ref_v[t] * l.dts[t];
+    }
+  }
+}
+
+// Entry k of the full initial state, 0 past the end of `state`
+inline double initial_state(const VectorRef& state, size_t k) {
+  return k < size_t(state.size()) ? state[k] : 0.0;
+}
+
+// Assembles the trajectory described by `vars` starting from `state`.
+//
+// States at shooting nodes are read from `vars` and every other state is
+// rolled out through the model from its predecessor. When `defects` is given
+// it receives one value per node state: the initial state itself for a node
+// at t = 0, and the gap between the node variable and the rolled-out state
+// otherwise. With `rollout` set, node variables are ignored and the whole
+// trajectory is rolled out from `state`.
+//
+// Shared by FG_eval (AD<double>) and the double-precision reconstruction of
+// solutions and rollouts, so every transcription uses the same model and cost.
+// Templated on the discretised model (see vehicle_model.h), so every model
+// and integrator gets its own transcription with the dynamics inlined.
+template <typename Scalar, typename Alloc, typename Vector, typename Dynamics>
+void transcribe(const Layout& l, const Vector& vars, const VectorRef& state,
+                const VectorRef& coeffs, const Dynamics& dynamics, bool rollout,
+                Trajectory<Scalar, Alloc>& tr, Scalar* defects) {
+  const size_t n_nodes = l.nodes.size();
+
+  for(unsigned int b = 0; b < l.M; ++b){
+    tr.delta[b] = vars[l.delta_start + b];
+    tr.a[b] = vars[l.a_start + b];
+  }
+
+  for(unsigned int t = 0; t < l.N; ++t){
+    Scalar s1[full_states];
+    if (t == 0) {
+      for (size_t k : l.states) {
+        s1[k] = initial_state(state, k);
+      }
+    } else {
+      Scalar s0[full_states];
+      for (size_t k : l.states) {
+        s0[k] = tr.state(k)[t - 1];
+      }
+      size_t b = l.blocks[t - 1];
+      dynamics.step(s0, tr.delta[b], tr.a[b], l.dts[t - 1], l.error_states, coeffs, s1);
+    }
+
+    long node = l.node_of[t];
+    for(unsigned int j = 0; j < l.n_states; ++j){
+      size_t k = l.states[j];
+      if (node < 0 || rollout) {
+        tr.state(k)[t] = s1[k];
+        continue;
+      }
+      tr.state(k)[t] = vars[l.state_start(j) + node];
+      if (defects != NULL) {
+        defects[j * n_nodes + node] = t == 0 ? tr.state(k)[t] : tr.state(k)[t] - s1[k];
+      }
+    }
+  }
+
+  // Without error states, cte and epsi are plain expressions of the states
+  if (!l.error_states) {
+    for(unsigned int t = 0; t < l.N; ++t){
+      path_errors(tr.x[t], tr.y[t], tr.psi[t], coeffs, tr.cte[t], tr.epsi[t]);
+    }
+  }
+}
+
+template <typename Scalar, typename Alloc, typename Vector>
+struct Transcriber {
+  const Layout& l;
+  const Vector& vars;
+  const VectorRef& state;
+  const VectorRef& coeffs;
+  bool rollout;
+  Trajectory<Scalar, Alloc>& tr;
+  Scalar* defects;
 
+  template <typename Dynamics>
+  void operator()(const Dynamics& dynamics) {
+    transcribe(l, vars, state, coeffs, dynamics, rollout, tr, defects);
+  }
+};
+
+// Same, with the model selected at runtime. Dispatches once for the whole
+// trajectory.
+template <typename Scalar, typename Alloc, typename Vector>
+void transcribe(const Layout& l, const Vector& vars, const VectorRef& state,
+                const VectorRef& coeffs, const ModelConfig& model, bool rollout,
+                Trajectory<Scalar, Alloc>& tr, Scalar* defects) {
+  Transcriber<Scalar, Alloc, Vector> transcriber = {l, vars, state, coeffs, rollout, tr, defects};
+  dispatch_dynamics(model, transcriber);
+}
+
+// Completes an initial guess whose actuators are set: the node states follow
+// the rollout of those actuators, or only the initial state is set when
+// `roll_nodes` is false.
+template <typename Vector>
+void guess_states(const Layout& l, const VectorRef& state, const VectorRef& coeffs,
+                  const ModelConfig& model, bool roll_nodes, Vector& vars, Arena& arena) {
+  Arena::Scope scope(arena);
+  ScratchTrajectory guess(l, ArenaAllocator<double>(arena));
+  transcribe(l, vars, state, coeffs, model, true, guess, (double*)NULL);
+  for (size_t node = 0; node < l.nodes.size(); ++node) {
+    if (roll_nodes || l.nodes[node] == 0) {
+      for (size_t j = 0; j < l.n_states; ++j) {
+        vars[l.state_start(j) + node] = guess.state(l.states[j])[l.nodes[node]];
+      }
+    }
+  }
+}
+
+// CppAD keeps tapes and memory per thread and needs to know which one is running
+bool cppad_in_parallel() { return ThreadPool::in_parallel(); }
+size_t cppad_thread_num() { return ThreadPool::thread_num(); }
+
+// CppAD's thread setup is process-wide, so it is done once, sized for the
+// largest pool any MPC builds (one worker per start) and the calling thread.
+// Must run while no other thread uses CppAD.
+void setup_cppad_threads() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    CppAD::thread_alloc::parallel_setup(max_starts + 1, cppad_in_parallel, cppad_thread_num);
+    CppAD::parallel_ad<double>();
+  });
+}
+
+template <typename Dynamics>
 class FG_eval {
  public:
   // Fitted polynomial coefficients
-  Eigen::VectorXd coeffs;
-  FG_eval(Eigen::VectorXd coeffs) { this->coeffs = coeffs; }
+  const VectorRef& coeffs;
+  // Initial state the trajectory is rolled out from
+  const VectorRef& state;
+  // Position of every variable for the horizon being solved
+  const Layout& layout;
+  const Objective& objective;
+  // Reference speed of every timestep
+  const double* ref_v;
+  // Discretised model the trajectory is rolled out with
+  Dynamics dynamics;
+  FG_eval(const VectorRef& coeffs, const VectorRef& state, const Layout& layout,
+          const Objective& objective, const double* ref_v, const Dynamics& dynamics)
+      : coeffs(coeffs), state(state), layout(layout), objective(objective), ref_v(ref_v),
+        dynamics(dynamics) {}
 
   typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
 
   void operator()(ADvector& fg, const ADvector& vars) {
-    // TODO: implement MPC
     // `fg` a vector of the cost constraints, `vars` is a vector of variable values (state & actuators)
-    // NOTE: You'll probably go back and forth between this function and
-    // the Solver function below.
+    Trajectory<AD<double> > tr(layout);
+    vector<AD<double> > defects(layout.n_constraints);
+    transcribe(layout, vars, state, coeffs, dynamics, false, tr, defects.data());
 
     // fg[0] stores the cost
-    for(unsigned int i = 0; i < fg.size(); ++i){
-      fg[i] = 0.0;
-    }
-    fg[0] = setCost(vars);    
+    fg[0] = trajectory_cost(layout, objective, ref_v, tr);
 
     // Now we set up the constraints of the model
-    // All indices are offset by 1 because we store the cost at position 0    
-    fg[1 + x_start] = vars[x_start];
-    fg[1 + y_start] = vars[y_start];
-    fg[1 + psi_start] = vars[psi_start];
-    fg[1 + v_start] = vars[v_start];
-    fg[1 + cte_start] = vars[cte_start];
-    fg[1 + epsi_start] = vars[epsi_start];    
-
-    // We define the rest of the constraints in relation to their value at t-1
-    for(unsigned int t = 1; t < N; ++t){      
-      AD<double> x1 = vars[x_start + t];
-      AD<double> y1 = vars[y_start + t];      
-
-      AD<double> x0 = vars[x_start + t - 1];
-      AD<double> y0 = vars[y_start + t - 1];      
-
-      AD<double> psi0 = vars[psi_start + t - 1];
-      AD<double> psi1 = vars[psi_start + t];      
-      
-      AD<double> v0 = vars[v_start + t - 1];
-      AD<double> v1 = vars[v_start + t];      
-
-      AD<double> delta0 = vars[delta_start + t - 1];
-      
-      AD<double> a0 = vars[a_start + t - 1];      
-
-      AD<double> cte0 = vars[cte_start + t - 1];
-      AD<double> cte1 = vars[cte_start + t];      
-
-      AD<double> epsi0 = vars[epsi_start + t - 1];
-      AD<double> epsi1 = vars[epsi_start + t];
-      
-      // We can now set up the rest of the constraints
-      fg[1 + x_start + t] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-      fg[1 + y_start + t] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
-      
-      // We do psi0 - ... because in the simulator a negative value implies a right turn
-      // and a positive one implies a left turn
-      fg[1 + psi_start + t] = psi1 - (psi0 - (v0 / Lf) * delta0 * dt);
-      fg[1 + v_start + t] = v1 - (v0 + a0 * dt);
-                      
-      AD<double> fx = coeffs[0] + coeffs[1] * x0 + coeffs[2] * (x0 * x0) + coeffs[3] * (x0 * x0 * x0);
-            
-      AD<double> fprime_x = coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * (x0 * x0);      
-      
-      AD<double> desired_psi = CppAD::atan(fprime_x);      
-
-      fg[1 + cte_start + t] = cte1 - (fx - y0 + v0 * CppAD::sin(epsi0) * dt);
-      fg[1 + epsi_start + t] = epsi1 - (psi0 - desired_psi + (v0 / Lf) * delta0 * dt);        
-    }
-  }
-
-  private:
-
-    // Returns the computed cost based off our variables
-    AD<double> setCost(const ADvector& vars){
-      AD<double> cost = 0.0;
-      // double d1 = 0;
-      // First step is to add cte, epsi as well as velocity difference to cost
-      for (unsigned int t = 0; t < N; t++) {
-        cost += 1000 * CppAD::pow(vars[cte_start + t], 2);
-        cost += 10000 * CppAD::pow(vars[cte_start + t] * vars[delta_start + t], 2);
-        cost += 10000 * CppAD::pow(vars[epsi_start + t], 2);
-        cost += 10 * CppAD::pow(vars[v_start + t] - ref_v, 2);
-      }
-
-      // Then we want to minimise the use of actuators for a smoother ride
-      for (unsigned int t = 0; t < N - 1; t++) {
-        cost += 10 * CppAD::pow(vars[delta_start + t], 2);
-        cost += 100 * CppAD::pow(vars[a_start + t], 2);
-        cost += 100 * CppAD::pow(vars[a_start + t] * vars[delta_start + t], 2);
-      }
-
-      // Finally. we want to minimise sudden changes between successive states
-      for(unsigned int t = 0; t < N - 2; ++t){
-        cost += 10 * CppAD::pow(vars[delta_start + t + 1] - vars[delta_start + t], 2);        
-        cost += 10 * CppAD::pow(vars[a_start + t + 1] - vars[a_start + t], 2);        
-      }
-
-      return cost;
+    // All indices are offset by 1 because we store the cost at position 0
+    for(unsigned int i = 0; i < layout.n_constraints; ++i){
+      fg[1 + i] = defects[i];
     }
+  }
+};
+
+// Runs Ipopt from one start with the FG_eval of the model it is called with
+struct NlpSolve {
+  const VectorRef& coeffs;
+  const VectorRef& state;
+  const Layout& layout;
+  const Objective& objective;
+  const double* ref_v;
+  const string& options;
+  const Dvector& start;
+  const Dvector& vars_lowerbound;
+  const Dvector& vars_upperbound;
+  const Dvector& constraints_lowerbound;
+  const Dvector& constraints_upperbound;
+  CppAD::ipopt::solve_result<Dvector>& solution;
 
+  template <typename Dynamics>
+  void operator()(const Dynamics& dynamics) {
+    // object that computes objective and constraints
+    FG_eval<Dynamics> fg_eval(coeffs, state, layout, objective, ref_v, dynamics);
+    CppAD::ipopt::solve<Dvector, FG_eval<Dynamics> >(
+        options, start, vars_lowerbound, vars_upperbound, constraints_lowerbound,
+        constraints_upperbound, fg_eval, solution);
+  }
 };
 
 
 //
 // MPCResult class definition implementation.
 //
-MPCResult::MPCResult() {}
-MPCResult::~MPCResult() {}
+MPCResult::MPCResult() : cte(0.0), cost(0.0), quality(SOLVE_OPTIMAL) {}
+
+void MPCResult::Reset(size_t N) {
+  trajectory.Clear();
+  trajectory.Reserve(N);
+  cte = 0.0;
+  cost = 0.0;
+  quality = SOLVE_OPTIMAL;
+}
+
+Span<double> MPCResult::view(PlanTrajectory::Quantity q, size_t from) const {
+  size_t n = trajectory.length(q);
+  if (n <= from) {
+    return Span<double>();
+  }
+  return Span<double>(trajectory.get(q).data() + from, n - from);
+}
 
-double  MPCResult::next_steering_angle(){
-  return predicted_steering_angles[0];
+double  MPCResult::next_steering_angle() const {
+  PlanTrajectory::View steers = trajectory.delta();
+  return steers[0];
 
   double sum = 0.0;
   int steps = 6;
   for(unsigned int i = 0; i < steps; ++i){
-    sum += predicted_steering_angles[i];
+    sum += steers[i];
   }
   
   return sum / steps;
 }
 
-double MPCResult::next_throttle(){
-  return predicted_throttles[0];
+double MPCResult::next_throttle() const {
+  PlanTrajectory::View throttles = trajectory.a();
+  return throttles[0];
 
   double sum = 0.0;
   int steps = 6;
   for(unsigned int i = 0; i < steps; ++i){
-    sum += predicted_throttles[i];
+    sum += throttles[i];
   }
   
   return sum / steps;
@@ -175,171 +648,390 @@ double MPCResult::next_throttle(){
 //
 // MPC class definition implementation.
 //
-MPC::MPC() {}
+MPC::MPC()
+    : warm_start(false), feasibility_tol(1e-3), max_plan_age(0.3),
+      cache_(new Cache()), step_time_(0.0), smoothing_time_(0.0), smoothed_(0) {
+  multistart.enabled = false;
+  multistart.threads = 1;
+
+  smoothing.filter = Smoothing::MOVING_AVERAGE;
+  smoothing.window = 7;
+  smoothing.order = 2;
+
+  // Convert reference speed to meters per second
+  objective.ref_v = 70 * 0.44704;
+  objective.cte = 1000;
+  objective.cte_steer = 10000;
+  objective.epsi = 10000;
+  objective.speed = 10;
+  objective.steer = 10;
+  objective.throttle = 100;
+  objective.throttle_steer = 100;
+  objective.steer_rate = 10;
+  objective.throttle_rate = 10;
+  speed_reference.ds = 1.0;
+
+  // NOTE: Feel free to change the throttle limits to something else.
+  limits.max_steer = 0.436332;
+  limits.min_throttle = -1;
+  limits.max_throttle = 0.75;
+
+  formulation.error_states = true;
+  formulation.transcription = Formulation::SIMULTANEOUS;
+  formulation.shooting_interval = 5;
+
+  horizon.N = 25;
+  horizon.dt = 0.05;
+
+  adaptive.enabled = false;
+  adaptive.min_N = 10;
+  adaptive.max_N = 30;
+  adaptive.min_dt = 0.05;
+  adaptive.max_dt = 0.1;
+  adaptive.dt_step = 0.025;
+  adaptive.min_T = 0.75;
+  adaptive.max_T = 1.5;
+  adaptive.lateral_accel = 5.0;
+  adaptive.budget = 0.05;
+}
 MPC::~MPC() {}
 
-MPCResult MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs) {
+Horizon MPC::SelectHorizon(double v, const VectorRef& coeffs) const {
+  const AdaptiveHorizon& a = adaptive;
+  v = max(v, 0.0);
+
+  // Look further ahead the faster we drive
+  double T = a.min_T + (a.max_T - a.min_T) * min(v / objective.ref_v, 1.0);
+
+  // Largest curvature of the fitted path over the distance covered by the horizon
+  double kappa = 0.0;
+  for (int i = 0; i <= 2; ++i) {
+    double x = v * T * i / 2;
+    double fprime = coeffs[1] + 2 * coeffs[2] * x + 3 * coeffs[3] * x * x;
+    double fsecond = 2 * coeffs[2] + 6 * coeffs[3] * x;
+    kappa = max(kappa, fabs(fsecond) / pow(1 + fprime * fprime, 1.5));
+  }
+
+  // Use finer steps when the lateral acceleration demanded by the path is high,
+  // quantised so that only a few distinct (N, dt) pairs ever get cached
+  double demand = min(v * v * kappa / a.lateral_accel, 1.0);
+  double dt = a.max_dt - (a.max_dt - a.min_dt) * demand;
+  dt = a.min_dt + floor((dt - a.min_dt) / a.dt_step + 0.5) * a.dt_step;
+
+  size_t N = size_t(ceil(T / dt)) + 1;
+
+  // Respect the per-tick compute budget, coarsening the steps if the
+  // shortest horizon would still be too expensive
+  if (step_time_ > 0.0) {
+    size_t affordable = size_t(a.budget / step_time_);
+    while (N > affordable && N > a.min_N) {
+      --N;
+    }
+    if (N * dt < a.min_T && dt + a.dt_step <= a.max_dt) {
+      dt += a.dt_step;
+    }
+  }
+
+  Horizon h;
+  h.N = min(max(N, a.min_N), a.max_N);
+  h.dt = dt;
+  return h;
+}
+
+void MPC::Rollout(const VectorRef& state, const VectorRef& coeffs,
+                  double steer, double throttle, MPCResult& res) {
+  HorizonEntry& entry = cache_->get(horizon, formulation, model);
+  const Layout& l = entry.layout;
+  Arena::Scope scope(cache_->arena);
+  ArenaAllocator<double> alloc(cache_->arena);
+
+  vector<double, ArenaAllocator<double> > vars(l.n_vars, 0.0, alloc);
+  for(unsigned int b = 0; b < l.M; ++b){
+    vars[l.delta_start + b] = steer;
+    vars[l.a_start + b] = throttle;
+  }
+  ScratchTrajectory tr(l, alloc);
+  transcribe(l, vars, state, coeffs, model, true, tr, (double*)NULL);
+
+  res.Reset(l.N);
+  store_trajectory(l, tr, res.trajectory);
+
+  reference_speeds(l, objective, speed_reference, entry.ref_v);
+  res.cte = tr.cte[1];
+  res.cost = trajectory_cost(l, objective, entry.ref_v.data(), tr);
+}
+
+void MPC::Shift(const VectorRef& state, const VectorRef& coeffs, MPCResult& res) {
+  HorizonEntry& entry = cache_->get(horizon, formulation, model);
+  const Layout& l = entry.layout;
+  double age = chrono::duration<double>(chrono::steady_clock::now() - entry.last_time).count();
+
+  res.Reset(l.N);
+  res.quality = SOLVE_FAILED;
+  if (entry.plan.empty() || age > max_plan_age) {
+    return;
+  }
+
+  // The plan is advanced in place; its age still counts from when it was
+  // computed
+  Arena::Scope scope(cache_->arena);
+  entry.AdvancePlan(l.intervals(age));
+  vector<double>& vars = entry.shifted;
+  vars.assign(l.n_vars, 0.0);
+  plan_actuators(l, entry.plan, vars);
+  ScratchTrajectory tr(l, ArenaAllocator<double>(cache_->arena));
+  transcribe(l, vars, state, coeffs, model, true, tr, (double*)NULL);
+  store_trajectory(l, tr, res.trajectory);
+
+  reference_speeds(l, objective, speed_reference, entry.ref_v);
+  res.cte = tr.cte[1];
+  res.cost = trajectory_cost(l, objective, entry.ref_v.data(), tr);
+  res.quality = SOLVE_SHIFTED;
+}
+
+double MPC::ExpectedSolveTime() {
+  return cache_->get(horizon, formulation, model).solve_time;
+}
+
+void MPC::Solve(const VectorRef& state, const VectorRef& coeffs, MPCResult& res) {
+  // NOTE: Without a deadline the solver has a maximum time limit of 0.5 seconds.
+  Solve(state, coeffs, chrono::steady_clock::now() + chrono::milliseconds(500), res);
+}
+
+void MPC::Solve(const VectorRef& state, const VectorRef& coeffs,
+                chrono::steady_clock::time_point deadline, MPCResult& res) {
   bool ok = true;
   size_t i;
-  typedef CPPAD_TESTVECTOR(double) Dvector;
 
-  double x = state[0];
-  double y = state[1];
-  double psi = state[2];
   double v = state[3];
-  double cte = state[4];
-  double epsi = state[5];
 
-  // TODO: Set the number of model variables (includes both states and inputs).
-  // For example: If the state is a 4 element vector, the actuators is a 2
-  // element vector and there are 10 timesteps. The number of variables is:
-  //
-  // 4 * 10 + 2 * 9
-  size_t n_vars = 6 * N + 2 * (N - 1);
+  if (adaptive.enabled) {
+    horizon = SelectHorizon(v, coeffs);
+  }
+  HorizonEntry& entry = cache_->get(horizon, formulation, model);
+  const Layout& l = entry.layout;
+  const size_t N = l.N;
+
+  size_t n_vars = l.n_vars;
+  size_t n_constraints = l.n_constraints;
+
+  // More workers than starts would sit idle
+  size_t threads = multistart.enabled ? min(multistart.threads, max_starts) : 1;
+  if (threads > 1 && (!pool_ || pool_->size() != threads)) {
+    setup_cppad_threads();
+    pool_.reset(new ThreadPool(threads, multistart.thread_setup));
+  }
 
-  // TODO: Set the number of constraints
-  size_t n_constraints = 6 * N;
+  // Every buffer below is reused once this horizon has served a tick, and
+  // the result has room for the predictions. From then on, apart from the
+  // solver itself, a tick must not allocate on this thread (checked when
+  // built with MPC_COUNT_ALLOCATIONS).
+  res.Reset(N);
+  bool steady = entry.ticks++ > 0;
+  unsigned long allocations = heap_allocations();
+  unsigned long solver_allocations = 0;
+  auto check_allocations = [&]() {
+    assert(!steady || heap_allocations() - allocations == solver_allocations);
+  };
+  Arena::Scope scope(cache_->arena);
+  reference_speeds(l, objective, speed_reference, entry.ref_v);
 
   // Initial value of the independent variables.
   // SHOULD BE 0 besides initial state.
-  Dvector vars(n_vars);
-  for (int i = 0; i < n_vars; i++) {
-    vars[i] = 0.0;
-  }
-  // Set the initial variable values
-  vars[x_start] = x;
-  vars[y_start] = y;
-  vars[psi_start] = psi;
-  vars[v_start] = v;
-  vars[cte_start] = cte;
-  vars[epsi_start] = epsi;
-
-  Dvector vars_lowerbound(n_vars);
-  Dvector vars_upperbound(n_vars);
-  // TODO: Set lower and upper limits for variables.
-
-  // non-actuator lower and upper bound values should be close to 0
-  for (int i = 0; i < delta_start; i++) {
-    vars_lowerbound[i] = -1.0e19;
-    vars_upperbound[i] = 1.0e19;
-  }
-
-  // The upper and lower limits of delta are set to -25 and 25
-  // degrees (values in radians).
-  for (int i = delta_start; i < a_start; i++) {
-    vars_lowerbound[i] = -0.436332;
-    vars_upperbound[i] = 0.436332;
-  }
-
-  // Acceleration/decceleration upper and lower limits.
-  // NOTE: Feel free to change this to something else.
-  double v_upper_bound = 0.75;
-  for (int i = a_start; i < n_vars; i++) {
-    vars_lowerbound[i] = -1;
-    vars_upperbound[i] = v_upper_bound;
-  }
-
-  // Lower and upper limits for the constraints
-  // Should be 0 besides initial state.
-  Dvector constraints_lowerbound(n_constraints);
-  Dvector constraints_upperbound(n_constraints);
-  for (int i = 0; i < n_constraints; i++) {
-    constraints_lowerbound[i] = 0;
-    constraints_upperbound[i] = 0;
-  }
-  constraints_lowerbound[x_start] = x;
-  constraints_lowerbound[y_start] = y;
-  constraints_lowerbound[psi_start] = psi;
-  constraints_lowerbound[v_start] = v;
-  constraints_lowerbound[cte_start] = cte;
-  constraints_lowerbound[epsi_start] = epsi;
-
-  constraints_upperbound[x_start] = x;
-  constraints_upperbound[y_start] = y;
-  constraints_upperbound[psi_start] = psi;
-  constraints_upperbound[v_start] = v;
-  constraints_upperbound[cte_start] = cte;
-  constraints_upperbound[epsi_start] = epsi;
-
-  // object that computes objective and constraints
-  FG_eval fg_eval(coeffs);
-
-  //
-  // NOTE: You don't have to worry about these options
-  //
-  // options for IPOPT solver
-  std::string options;
-  // Uncomment this if you'd like more print information
-  options += "Integer print_level  0\n";
-  // NOTE: Setting sparse to true allows the solver to take advantage
-  // of sparse routines, this makes the computation MUCH FASTER. If you
-  // can uncomment 1 of these and see if it makes a difference or not but
-  // if you uncomment both the computation time should go up in orders of
-  // magnitude.
-  options += "Sparse  true        forward\n";
-  options += "Sparse  true        reverse\n";
-  // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
-  // Change this as you see fit.
-  options += "Numeric max_cpu_time          0.5\n";
+  size_t n_starts = 0;
+  auto start = [&]() -> Dvector& {
+    Dvector& vars = entry.starts[n_starts++];
+    for (size_t i = 0; i < n_vars; i++) {
+      vars[i] = 0.0;
+    }
+    return vars;
+  };
+  bool has_plan = !entry.plan.empty();
+  if (has_plan && (warm_start || multistart.enabled)) {
+    entry.AdvancePlan(1);
+  }
+
+  if (!multistart.enabled) {
+    Dvector& vars = start();
+
+    // Warm start the actuators from the previous plan shifted by one interval
+    if (warm_start && has_plan) {
+      plan_actuators(l, entry.plan, vars);
+    }
+
+    // Start the node states on the rollout of those actuators. The simultaneous
+    // transcription only needs its initial state unless warm starting.
+    bool roll_nodes = warm_start || formulation.transcription != Formulation::SIMULTANEOUS;
+    guess_states(l, state, coeffs, model, roll_nodes, vars, cache_->arena);
+  } else {
+    // The previous plan, then straight ahead and full lock either way
+    if (has_plan) {
+      Dvector& vars = start();
+      plan_actuators(l, entry.plan, vars);
+      guess_states(l, state, coeffs, model, true, vars, cache_->arena);
+    }
+    const double steers[] = {0.0, -limits.max_steer, limits.max_steer};
+    for (double steer : steers) {
+      Dvector& vars = start();
+      for (size_t b = 0; b < l.M; ++b) {
+        vars[l.delta_start + b] = steer;
+      }
+      guess_states(l, state, coeffs, model, true, vars, cache_->arena);
+    }
+  }
+
+  // The bounds are static apart from the initial state
+  if (!entry.has_bounds || !(entry.limits == limits)) {
+    entry.BuildBounds(limits);
+  }
+  const Dvector& vars_lowerbound = entry.vars_lowerbound;
+  const Dvector& vars_upperbound = entry.vars_upperbound;
+  Dvector& constraints_lowerbound = entry.constraints_lowerbound;
+  Dvector& constraints_upperbound = entry.constraints_upperbound;
+  if (!l.nodes.empty() && l.nodes[0] == 0) {
+    for (size_t j = 0; j < l.n_states; ++j) {
+      constraints_lowerbound[l.state_start(j)] = initial_state(state, l.states[j]);
+      constraints_upperbound[l.state_start(j)] = initial_state(state, l.states[j]);
+    }
+  }
 
   // place to return solution
-  CppAD::ipopt::solve_result<Dvector> solution;
+  auto& solutions = entry.solutions;
+  for (size_t s = 0; s < n_starts; ++s) {
+    solutions[s].status = CppAD::ipopt::solve_result<Dvector>::not_defined;
+  }
 
-  // solve the problem
-  CppAD::ipopt::solve<Dvector, FG_eval>(
-      options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-      constraints_upperbound, fg_eval, solution);
+  // Solves from one start, unless there is no time left to do so. Ipopt only
+  // checks its time limit between iterations, hence the margin.
+  auto solve = [&](size_t s, double budget) {
+    if (budget < min_solve_budget) {
+      return;
+    }
+    //
+    // NOTE: You don't have to worry about these options
+    //
+    // options for IPOPT solver
+    string& options = entry.options[s];
+    options.clear();
+    // Uncomment this if you'd like more print information
+    options += "Integer print_level  0\n";
+    // NOTE: Setting sparse to true allows the solver to take advantage
+    // of sparse routines, this makes the computation MUCH FASTER. If you
+    // can uncomment 1 of these and see if it makes a difference or not but
+    // if you uncomment both the computation time should go up in orders of
+    // magnitude.
+    options += "Sparse  true        forward\n";
+    options += "Sparse  true        reverse\n";
+    char limit[64];
+    snprintf(limit, sizeof(limit), "Numeric %s          %.9g\n", time_limit_option, budget);
+    options += limit;
+
+    NlpSolve nlp = {coeffs, state, l, objective, entry.ref_v.data(), options,
+                    entry.starts[s], vars_lowerbound, vars_upperbound,
+                    constraints_lowerbound, constraints_upperbound, solutions[s]};
+    dispatch_dynamics(model, nlp);
+  };
+
+  // The solver gets whatever time is left until the deadline: an equal share
+  // of it per start when they run one after another. Concurrent starts all
+  // get it in full, which is their wall time with max_wall_time. Under
+  // max_cpu_time they share the process CPU clock, so with k of them each
+  // stops after about budget / k of wall time: early, never late.
+  auto solve_start = chrono::steady_clock::now();
+  unsigned long before_solve = heap_allocations();
+  if (threads > 1) {
+    double budget = chrono::duration<double>(deadline - solve_start).count() - deadline_margin;
+    pool_->Run(n_starts, [&solve, budget](size_t s) { solve(s, budget); });
+  } else {
+    for (size_t s = 0; s < n_starts; ++s) {
+      double left = chrono::duration<double>(deadline - chrono::steady_clock::now()).count();
+      solve(s, left / (n_starts - s) - deadline_margin);
+    }
+  }
+  solver_allocations = heap_allocations() - before_solve;
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - solve_start).count();
+
+  // Track solve times per horizon and per timestep for the compute budget
+  if (solutions[0].status != CppAD::ipopt::solve_result<Dvector>::not_defined) {
+    ++entry.solves;
+    entry.solve_time += (elapsed - entry.solve_time) / entry.solves;
+    double per_step = elapsed / N;
+    step_time_ = step_time_ > 0.0 ? 0.9 * step_time_ + 0.1 * per_step : per_step;
+  }
+
+  // A solve stopped early is still usable when its iterate satisfies the model
+  auto is_feasible = [&](const CppAD::ipopt::solve_result<Dvector>& solution) {
+    bool feasible = solution.status != CppAD::ipopt::solve_result<Dvector>::not_defined &&
+                    solution.x.size() == n_vars && std::isfinite(solution.obj_value);
+    for (size_t i = 0; feasible && i < n_vars; ++i) {
+      feasible = std::isfinite(solution.x[i]);
+    }
+    for (size_t i = 0; feasible && i < n_constraints; ++i) {
+      feasible = solution.g[i] >= constraints_lowerbound[i] - feasibility_tol &&
+                 solution.g[i] <= constraints_upperbound[i] + feasibility_tol;
+    }
+    return feasible;
+  };
+
+  // Keep the cheapest feasible solution, or the first one when none is
+  size_t best = 0;
+  bool feasible = false;
+  for (size_t s = 0; s < n_starts; ++s) {
+    if (is_feasible(solutions[s]) &&
+        (!feasible || solutions[s].obj_value < solutions[best].obj_value)) {
+      best = s;
+      feasible = true;
+    }
+  }
+  const CppAD::ipopt::solve_result<Dvector>& solution = solutions[best];
 
-  
   // Check some of the solution values
   ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
 
-  // Cost
-  auto cost = solution.obj_value;
-  
+  // Fall back to the previous plan when there is no acceptable iterate
+  if (!feasible) {
+    Shift(state, coeffs, res);
+    if (res.quality == SOLVE_SHIFTED) {
+      check_allocations();
+      return;
+    }
+    res.Reset(N);
+  }
 
-  MPCResult res;
-  res.cost = cost;  
-  vector<double> next_xs;
-  vector<double> next_ys;  
-  vector<double> next_steers;  
-  vector<double> next_throttles;  
-  auto solution_vector = solution.x;
-  for(unsigned int j = 1; j < N; ++j){
-    next_xs.push_back(solution_vector[x_start + j]);
-    next_ys.push_back(solution_vector[y_start + j]);
-    
-    next_steers.push_back(solution_vector[delta_start + j - 1]);
-    next_throttles.push_back(solution_vector[a_start + j - 1]);
-  }
-
-  res.cte = solution_vector[cte_start + 1];
-
-  // This is an optimisation step which produces nicer, smoother trajectories
-  int steps = 7;
-  for(unsigned int i = 0; i < N - steps - 1; ++i){
-    double sum_steer = 0.0;
-    double sum_throttle = 0.0;    
-    for(int j = i; j < i + steps; ++j){
-      sum_steer += next_steers[j];
-      sum_throttle += next_throttles[j];      
-    }
-    next_steers[i] = sum_steer / steps;
-    next_throttles[i] = sum_throttle / steps;
-
-    // Recalculate v    
-    double v = solution_vector[v_start + i] + next_throttles[i] * dt;
-    
-    // Now recalculate next points
-    next_xs[i] = solution_vector[x_start + i] + v * cos(next_steers[i]) * dt; 
-    next_ys[i] = solution_vector[y_start + i] + v * sin(next_steers[i]) * dt; 
-  }
-
-  res.predicted_xs = next_xs;
-  res.predicted_ys = next_ys;
-  res.predicted_steering_angles = next_steers;
-  res.predicted_throttles = next_throttles;
-  
+  res.quality = !feasible ? SOLVE_FAILED : ok ? SOLVE_OPTIMAL : SOLVE_FEASIBLE;
+
+  bool solved = solution.status != CppAD::ipopt::solve_result<Dvector>::not_defined &&
+                solution.x.size() == n_vars;
+  const Dvector& solution_vector = solved ? solution.x : entry.starts[best];
+
+  // The simultaneous solution already is the whole trajectory; other
+  // transcriptions recover the states between shooting nodes
+  PlanTrajectory& plan = res.trajectory;
+  if (l.dense() && solved) {
+    plan.Assign(N, solution_vector.data());
+    res.cost = solution.obj_value;
+  } else {
+    ScratchTrajectory tr(l, ArenaAllocator<double>(cache_->arena));
+    transcribe(l, solution_vector, state, coeffs, model, false, tr, (double*)NULL);
+    store_trajectory(l, tr, plan);
+    res.cost = solved ? solution.obj_value : trajectory_cost(l, objective, entry.ref_v.data(), tr);
+  }
+  if (feasible) {
+    entry.plan = plan;
+    entry.plan_shift = 0;
+    entry.last_time = chrono::steady_clock::now();
+  }
+
+  // Smooth the actuations and predict the trajectory they produce
+  auto smooth_start = chrono::steady_clock::now();
+  cache_->smoother.Apply(smoothing, limits, l.dts, model, formulation.error_states, state,
+                         coeffs, plan);
+  if (smoothing.filter != Smoothing::NONE) {
+    double smooth_time = chrono::duration<double>(chrono::steady_clock::now() - smooth_start).count();
+    ++smoothed_;
+    smoothing_time_ += (smooth_time - smoothing_time_) / smoothed_;
+  }
+  res.cte = plan.cte()[1];
 
-  return res;  
+  check_allocations();
 }
@@ -1,31 +1,204 @@
 #ifndef MPC_H
 #define MPC_H
 
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
+#include "span.h"
+#include "trajectory.h"
+#include "vehicle_model.h"
 
 using namespace std;
 
+// Read-only view of any contiguous vector (dynamic or fixed-size, or a
+// segment of one), so that inputs are never copied.
+typedef Eigen::Ref<const Eigen::VectorXd> VectorRef;
 
+
+// How a result was obtained, best first.
+enum SolveQuality {
+  // The solver converged
+  SOLVE_OPTIMAL,
+  // The solver stopped early (deadline, iteration limit) at an iterate that
+  // satisfies the model constraints
+  SOLVE_FEASIBLE,
+  // Not from the solver: the approximate policy's actuations held over the
+  // horizon, accepted by its safety monitor (see policy.h)
+  SOLVE_APPROXIMATED,
+  // No acceptable iterate: the previous plan advanced by the elapsed time
+  SOLVE_SHIFTED,
+  // Closed-form path tracking law, used by the controller when no plan is
+  // recent enough (see tracking.h)
+  SOLVE_TRACKED,
+  // Nothing usable, the iterate returned violates the model
+  SOLVE_FAILED
+};
+
+// Owned by the caller and filled in by MPC, so that its storage is reused
+// from one tick to the next.
 class MPCResult {
 
   public:
 
-  vector<double> predicted_xs;
-  vector<double> predicted_ys;
-  
-  vector<double> predicted_steering_angles;
-  vector<double> predicted_throttles;
+  // Whole predicted trajectory from the initial state, empty when nothing
+  // was predicted
+  PlanTrajectory trajectory;
   double cte;
   double cost;
+  SolveQuality quality;
+
+  double next_steering_angle() const;
+  double next_throttle() const;
+
+  // Predicted positions after the initial state, and the actuation over
+  // every interval
+  Span<double> xs() const { return view(PlanTrajectory::X, 1); }
+  Span<double> ys() const { return view(PlanTrajectory::Y, 1); }
+  Span<double> steering_angles() const { return view(PlanTrajectory::DELTA, 0); }
+  Span<double> throttles() const { return view(PlanTrajectory::A, 0); }
+
+  // Empties the predictions, keeping room for an N-step horizon
+  void Reset(size_t N);
 
-  double next_steering_angle();
-  double next_throttle();
-  
   MPCResult();
-  virtual ~MPCResult();
+
+  private:
+
+  Span<double> view(PlanTrajectory::Quantity q, size_t from) const;
+};
+
+
+// A run of `steps` intervals of length `dt`, with the actuators held
+// constant over every `hold` consecutive intervals (move blocking).
+struct GridSegment {
+  size_t steps;
+  double dt;
+  size_t hold;
 };
 
+// Number of timesteps and their duration. When segments are given they
+// describe a non-uniform, move-blocked grid and N / dt are derived from it.
+struct Horizon {
+  size_t N;
+  double dt;
+  vector<GridSegment> segments;
+};
+
+// Builds a horizon from a non-uniform grid description.
+Horizon make_blocked_horizon(const vector<GridSegment>& segments);
+
+// Limits for picking the horizon per tick from speed and path curvature.
+struct AdaptiveHorizon {
+  bool enabled;
+
+  size_t min_N;
+  size_t max_N;
+  // dt is quantised to multiples of dt_step above min_dt
+  double min_dt;
+  double max_dt;
+  double dt_step;
+  // Horizon duration N * dt grows from min_T to max_T with speed
+  double min_T;
+  double max_T;
+  // Lateral acceleration (m/s^2) at which the finest dt is used
+  double lateral_accel;
+  // Per-tick solve time budget (seconds)
+  double budget;
+};
+
+// How the optimisation problem is transcribed.
+struct Formulation {
+  // Carry cte and epsi as decision variables with their own equality
+  // constraints (true), or evaluate them from (x, y, psi) and the path
+  // polynomial inside the cost (false), which removes 2N variables and
+  // 2N constraints.
+  bool error_states;
+
+  // SIMULTANEOUS keeps every state as a decision variable (direct
+  // transcription). SINGLE_SHOOTING only optimises the actuators and rolls
+  // the states out inside the evaluator. MULTIPLE_SHOOTING keeps the states
+  // every `shooting_interval` timesteps, tied together by continuity
+  // constraints.
+  enum Transcription { SIMULTANEOUS, MULTIPLE_SHOOTING, SINGLE_SHOOTING };
+  Transcription transcription;
+  size_t shooting_interval;
+};
+
+// Actuator bounds. Changing them rebuilds the solver's variable bounds on
+// the next solve.
+struct ActuatorLimits {
+  // Steering angle magnitude (radians)
+  double max_steer;
+  double min_throttle;
+  double max_throttle;
+
+  bool operator==(const ActuatorLimits& o) const {
+    return max_steer == o.max_steer && min_throttle == o.min_throttle &&
+           max_throttle == o.max_throttle;
+  }
+};
+
+// Terms of the cost: the speed to drive at and the weight of every squared
+// term, in the order trajectory_cost adds them.
+struct Objective {
+  // Reference speed (m/s), unless a SpeedReference is given
+  double ref_v;
+  // Cross track error, alone and times the steering angle, heading error and
+  // speed error, at every timestep
+  double cte;
+  double cte_steer;
+  double epsi;
+  double speed;
+  // Actuations, and throttle times steering, over every interval
+  double steer;
+  double throttle;
+  double throttle_steer;
+  // Changes of the actuations between consecutive blocks
+  double steer_rate;
+  double throttle_rate;
+};
+
+// Reference speed along the path ahead, sampled every `ds` metres from the
+// vehicle (see speed_profile.h). Every timestep of the horizon takes the
+// sample at the distance covered by driving the reference itself up to it;
+// timesteps beyond the last sample take the last one. Without samples every
+// timestep uses Objective::ref_v.
+struct SpeedReference {
+  double ds;
+  vector<double> speeds;
+};
+
+// Several solves per tick from different initial guesses (the previous plan
+// shifted, straight ahead, full lock left and right), keeping the cheapest
+// feasible result, to escape the poor local minima of the nonconvex problem.
+struct MultiStart {
+  bool enabled;
+  // Concurrent solves. With 1 the starts run one after another and share
+  // the time until the deadline. More than 1 needs Ipopt built with a
+  // thread-safe linear solver. Capped at the number of starts.
+  size_t threads;
+  // Runs on every worker thread as it starts, with its number (from 1)
+  function<void(size_t)> thread_setup;
+};
+
+// Filter applied to the planned actuations after every solve (see
+// smoothing.h). The states are then rolled out again through the bicycle
+// model, so that the predicted trajectory is the one the filtered
+// actuations produce.
+struct Smoothing {
+  // MOVING_AVERAGE averages every actuation with the ones planned after it.
+  // SAVITZKY_GOLAY fits a polynomial of degree `order` over a centred window
+  // around every actuation, which follows ramps without lagging them.
+  enum Filter { NONE, MOVING_AVERAGE, SAVITZKY_GOLAY };
+  Filter filter;
+  // Intervals per window, rounded up to an odd number for Savitzky-Golay
+  size_t window;
+  size_t order;
+};
+
+class ThreadPool;
 
 class MPC {
  public:
@@ -33,9 +206,84 @@ class MPC {
 
   virtual ~MPC();
 
+  Formulation formulation;
+
+  ActuatorLimits limits;
+
+  Objective objective;
+
+  // Set every tick, before solving, to follow a speed profile
+  SpeedReference speed_reference;
+
+  // Prediction model, kinematic or dynamic, its integrator and parameters (see
+  // vehicle_model.h)
+  ModelConfig model;
+
+  // Initialise each solve from the previous plan shifted by one interval
+  bool warm_start;
+
+  // Horizon used by the next solve (updated every tick when adaptive)
+  Horizon horizon;
+  AdaptiveHorizon adaptive;
+
+  // Pick N and dt from the vehicle speed (m/s) and the fitted path.
+  Horizon SelectHorizon(double v, const VectorRef& coeffs) const;
+
+  // Largest constraint violation accepted from a solve stopped early
+  double feasibility_tol;
+
+  // Oldest plan (seconds) still worth shifting and reusing
+  double max_plan_age;
+
+  MultiStart multistart;
+
+  Smoothing smoothing;
+
   // Solve the model given an initial state and polynomial coefficients.
-  // Return the first actuatotions.
-  MPCResult Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs);
+  // Writes the actuations and predicted trajectory into res. The state is
+  // [x, y, psi, v, cte, epsi], followed by [vy, r] for the dynamic model
+  // (taken as 0 when missing).
+  void Solve(const VectorRef& state, const VectorRef& coeffs, MPCResult& res);
+
+  // Same, returning by the given wall-clock deadline with the best result
+  // available then; see MPCResult::quality. With Ipopt before 3.14 the limit
+  // is enforced in process CPU time, which stops concurrent multi-start
+  // solves early.
+  void Solve(const VectorRef& state, const VectorRef& coeffs,
+             chrono::steady_clock::time_point deadline, MPCResult& res);
+
+  // The last accepted plan advanced by the time elapsed since it was
+  // computed and rolled out from the given state. Costs a rollout. The
+  // quality is SOLVE_FAILED, with nothing predicted, when there is no plan
+  // for the current horizon or it is older than max_plan_age.
+  void Shift(const VectorRef& state, const VectorRef& coeffs, MPCResult& res);
+
+  // Average solve time (seconds) for the current horizon, 0 before any solve.
+  // Not const, like Rollout: both set up the horizon's layout on first use.
+  double ExpectedSolveTime();
+
+  // Average time (seconds) spent smoothing a solution
+  double SmoothingTime() const { return smoothing_time_; }
+
+  // Roll the bicycle model out over the horizon holding the given actuations
+  // constant, and price the resulting trajectory with the solver's cost.
+  // Uses the solver's scratch memory, so it must not run during a solve.
+  void Rollout(const VectorRef& state, const VectorRef& coeffs,
+               double steer, double throttle, MPCResult& res);
+
+ private:
+  // Layouts and statistics for every (N, dt) pair solved so far
+  struct Cache;
+  unique_ptr<Cache> cache_;
+
+  // Workers for concurrent multi-start solves
+  unique_ptr<ThreadPool> pool_;
+
+  // Smoothed solve time per timestep (seconds), used for the compute budget
+  double step_time_;
+
+  double smoothing_time_;
+  unsigned long smoothed_;
 };
 
 
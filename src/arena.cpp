@@ -0,0 +1,82 @@
+#include "arena.h"
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef MPC_COUNT_ALLOCATIONS
+namespace {
+
+// Per thread, so that a thread loading a new configuration does not count
+// against the control thread's ticks
+thread_local unsigned long allocations = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocations;
+  void* p = malloc(size > 0 ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+unsigned long heap_allocations() {
+  return allocations;
+}
+#else
+unsigned long heap_allocations() {
+  return 0;
+}
+#endif
+
+//
+// Arena class definition implementation.
+//
+Arena::Arena(size_t capacity)
+    : block_(new char[capacity]), capacity_(capacity), used_(0), depth_(0),
+      overflow_bytes_(0) {}
+
+Arena::~Arena() {
+  for (char* block : overflow_) {
+    delete[] block;
+  }
+  delete[] block_;
+}
+
+void* Arena::Allocate(size_t bytes, size_t align) {
+  uintptr_t base = reinterpret_cast<uintptr_t>(block_);
+  size_t offset = ((base + used_ + align - 1) & ~(uintptr_t)(align - 1)) - base;
+  if (offset + bytes <= capacity_) {
+    used_ = offset + bytes;
+    return block_ + offset;
+  }
+
+  // Out of room: take a block of its own from the heap until the next reset
+  char* block = new char[bytes + align];
+  overflow_.push_back(block);
+  overflow_bytes_ += bytes + align;
+  uintptr_t p = reinterpret_cast<uintptr_t>(block);
+  return reinterpret_cast<void*>((p + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+void Arena::Release(size_t mark) {
+  used_ = mark;
+  if (--depth_ > 0 || overflow_.empty()) {
+    return;
+  }
+
+  // Grow the main block so the next tick fits in it
+  for (char* block : overflow_) {
+    delete[] block;
+  }
+  overflow_.clear();
+  delete[] block_;
+  capacity_ += overflow_bytes_;
+  overflow_bytes_ = 0;
+  block_ = new char[capacity_];
+}
@@ -0,0 +1,85 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+//
+// Bump allocator for the scratch memory of a solver tick.
+//
+// Allocations are carved out of a single block and released together when
+// the Scope they were made in ends. A tick that needs more than the block
+// holds takes further blocks from the heap; once the outermost scope ends
+// they are merged into one block large enough for all of them, so that in
+// steady state the arena does not touch the heap.
+//
+class Arena {
+ public:
+  explicit Arena(size_t capacity = 64 * 1024);
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* Allocate(size_t bytes, size_t align);
+
+  // Releases everything allocated while it is alive
+  class Scope {
+   public:
+    explicit Scope(Arena& arena) : arena_(arena), mark_(arena.used_) { ++arena.depth_; }
+    ~Scope() { arena_.Release(mark_); }
+
+   private:
+    Arena& arena_;
+    size_t mark_;
+  };
+
+  size_t capacity() const { return capacity_; }
+
+ private:
+  void Release(size_t mark);
+
+  char* block_;
+  size_t capacity_;
+  size_t used_;
+  // Scopes alive; overflow blocks stay until the outermost one ends, even
+  // when nothing fit in the main block before it
+  size_t depth_;
+
+  // Blocks taken from the heap when the main one ran out, and their size
+  std::vector<char*> overflow_;
+  size_t overflow_bytes_;
+};
+
+// Standard allocator drawing from an Arena. Memory is only given back when
+// the enclosing Arena::Scope ends.
+template <typename T>
+struct ArenaAllocator {
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena& arena) : arena(&arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T))); }
+  void deallocate(T*, size_t) {}
+
+  Arena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena != b.arena;
+}
+
+// Number of heap allocations (operator new) made so far on the calling
+// thread.
+// Only counted when built with MPC_COUNT_ALLOCATIONS, 0 otherwise.
+unsigned long heap_allocations();
+
+#endif /* ARENA_H */
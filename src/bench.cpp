@@ -0,0 +1,252 @@
+// Solve-time benchmark for the different MPC formulations.
+//
+// Runs MPC::Solve over a fixed set of synthetic scenarios (speeds and path
+// polynomials) for every configuration and reports the wall-clock solve
+// time distribution, the mean time spent in the smoothing stage and the mean
+// cost. Then times one evaluation of every vehicle model's derivative and of
+// its analytic Jacobian, and checks the Jacobian against central differences
+// of the derivative. Exits with 1 if they disagree.
+//
+//   ./mpc_bench [scenarios]
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "MPC.h"
+#include "vehicle_model.h"
+
+struct Scenario {
+  Eigen::VectorXd state;
+  Eigen::VectorXd coeffs;
+};
+
+struct BenchCase {
+  string name;
+  std::function<void(MPC&)> configure;
+};
+
+// Paths ahead of the vehicle in vehicle coordinates, as fitted in main.cpp
+vector<Scenario> make_scenarios(int count) {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> speed(5.0, 35.0);
+  std::uniform_real_distribution<double> offset(-1.5, 1.5);
+  std::uniform_real_distribution<double> slope(-0.2, 0.2);
+  std::uniform_real_distribution<double> bend(-0.01, 0.01);
+  std::uniform_real_distribution<double> twist(-1e-4, 1e-4);
+
+  vector<Scenario> scenarios;
+  for (int i = 0; i < count; ++i) {
+    Scenario s;
+    s.coeffs = Eigen::VectorXd(4);
+    s.coeffs << offset(rng), slope(rng), bend(rng), twist(rng);
+    s.state = Eigen::VectorXd(6);
+    s.state << 0, 0, 0, speed(rng), s.coeffs[0], -atan(s.coeffs[1]);
+    scenarios.push_back(s);
+  }
+  return scenarios;
+}
+
+void run(const BenchCase& c, const vector<Scenario>& scenarios) {
+  MPC mpc;
+  c.configure(mpc);
+
+  vector<double> times;
+  double cost = 0.0;
+  MPCResult res;
+  for (const Scenario& s : scenarios) {
+    auto start = std::chrono::steady_clock::now();
+    mpc.Solve(s.state, s.coeffs, res);
+    times.push_back(std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count());
+    cost += res.cost;
+  }
+
+  std::sort(times.begin(), times.end());
+  double mean = 0.0;
+  for (double t : times) {
+    mean += t;
+  }
+  mean /= times.size();
+
+  std::cout << std::left << std::setw(28) << c.name << std::right << std::fixed
+            << std::setprecision(3)
+            << std::setw(10) << mean
+            << std::setw(10) << times[times.size() / 2]
+            << std::setw(10) << times[times.size() * 95 / 100]
+            << std::setw(10) << times.back()
+            << std::setprecision(1) << std::setw(12) << mpc.SmoothingTime() * 1e6
+            << std::setw(14) << cost / scenarios.size()
+            << std::endl;
+}
+
+// Largest relative error of a model's analytic Jacobian against central
+// differences of its deriv, over the scenarios
+template <typename Model>
+double jacobian_error(const Model& model, const vector<Scenario>& scenarios) {
+  const size_t n = Model::kStates;
+  const double h = 1e-6;
+  Eigen::MatrixXd A, B;
+  double worst = 0.0;
+  for (const Scenario& s : scenarios) {
+    const double state[full_states] = {0.0, 0.0, s.state[5], s.state[3], 0.0, 0.0, 0.5, 0.1};
+    const double delta = 0.05, a = 0.3;
+    model.jacobian(state, delta, a, A, B);
+    // Perturbs every state, then the steering and the throttle
+    for (size_t j = 0; j < n + 2; ++j) {
+      double plus[full_states], minus[full_states];
+      std::copy(state, state + full_states, plus);
+      std::copy(state, state + full_states, minus);
+      double delta_plus = delta, delta_minus = delta, a_plus = a, a_minus = a;
+      if (j < n) {
+        plus[Model::state(j)] += h;
+        minus[Model::state(j)] -= h;
+      } else if (j == n) {
+        delta_plus += h;
+        delta_minus -= h;
+      } else {
+        a_plus += h;
+        a_minus -= h;
+      }
+      double ds_plus[full_states] = {0.0}, ds_minus[full_states] = {0.0};
+      model.deriv(plus, delta_plus, a_plus, ds_plus);
+      model.deriv(minus, delta_minus, a_minus, ds_minus);
+      for (size_t i = 0; i < n; ++i) {
+        size_t k = Model::state(i);
+        double fd = (ds_plus[k] - ds_minus[k]) / (2 * h);
+        double analytic = j < n ? A(i, j) : B(i, j - n);
+        worst = std::max(worst, fabs(fd - analytic) / (1.0 + fabs(fd)));
+      }
+    }
+  }
+  return worst;
+}
+
+// Mean time (ns) of one deriv and one jacobian evaluation of a model, and
+// the error of the Jacobian (see jacobian_error), which is returned
+template <typename Model>
+double time_model(const string& name, const Model& model,
+                const vector<Scenario>& scenarios) {
+  const int repeats = 1000;
+  double ds[full_states] = {0.0};
+  Eigen::MatrixXd A, B;
+  // Keeps the evaluations from being optimised away
+  volatile double sink = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeats; ++i) {
+    for (const Scenario& s : scenarios) {
+      double state[full_states] = {0.0, 0.0, 0.0, s.state[3], 0.0, 0.0, 0.5, 0.1};
+      model.deriv(state, 0.05 + 1e-6 * i, 0.3, ds);
+      sink = sink + ds[0] + ds[1] + ds[2] + ds[3] + ds[6] + ds[7];
+    }
+  }
+  auto middle = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeats; ++i) {
+    for (const Scenario& s : scenarios) {
+      double state[full_states] = {0.0, 0.0, 0.0, s.state[3], 0.0, 0.0, 0.5, 0.1};
+      model.jacobian(state, 0.05 + 1e-6 * i, 0.3, A, B);
+      sink = sink + A(2, 2);
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double n = double(repeats) * scenarios.size();
+  double error = jacobian_error(model, scenarios);
+  std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+            << std::setprecision(1)
+            << std::setw(12) << std::chrono::duration<double, std::nano>(middle - start).count() / n
+            << std::setw(12) << std::chrono::duration<double, std::nano>(end - middle).count() / n
+            << std::scientific << std::setprecision(1) << std::setw(14) << error
+            << std::endl;
+  return error;
+}
+
+int main(int argc, char* argv[]) {
+  int count = argc > 1 ? atoi(argv[1]) : 200;
+  vector<Scenario> scenarios = make_scenarios(count);
+
+  vector<BenchCase> cases;
+  cases.push_back({"cte/epsi states", [](MPC& mpc) {
+    mpc.formulation.error_states = true;
+  }});
+  cases.push_back({"cte/epsi in cost", [](MPC& mpc) {
+    mpc.formulation.error_states = false;
+  }});
+  cases.push_back({"multiple shooting (5)", [](MPC& mpc) {
+    mpc.formulation.transcription = Formulation::MULTIPLE_SHOOTING;
+    mpc.formulation.shooting_interval = 5;
+  }});
+  cases.push_back({"single shooting", [](MPC& mpc) {
+    mpc.formulation.transcription = Formulation::SINGLE_SHOOTING;
+  }});
+  cases.push_back({"single shooting, warm", [](MPC& mpc) {
+    mpc.formulation.transcription = Formulation::SINGLE_SHOOTING;
+    mpc.warm_start = true;
+  }});
+  cases.push_back({"no smoothing", [](MPC& mpc) {
+    mpc.smoothing.filter = Smoothing::NONE;
+  }});
+  cases.push_back({"Savitzky-Golay (7, 2)", [](MPC& mpc) {
+    mpc.smoothing.filter = Smoothing::SAVITZKY_GOLAY;
+    mpc.smoothing.window = 7;
+    mpc.smoothing.order = 2;
+  }});
+  cases.push_back({"multi-start, sequential", [](MPC& mpc) {
+    mpc.multistart.enabled = true;
+    mpc.multistart.threads = 1;
+  }});
+  cases.push_back({"multi-start, 4 threads", [](MPC& mpc) {
+    mpc.multistart.enabled = true;
+    mpc.multistart.threads = 4;
+  }});
+  cases.push_back({"dynamic, linear tires", [](MPC& mpc) {
+    mpc.model.type = ModelConfig::DYNAMIC;
+  }});
+  cases.push_back({"dynamic, Pacejka tires", [](MPC& mpc) {
+    mpc.model.type = ModelConfig::DYNAMIC;
+    mpc.model.dynamic.tire = DynamicModel::PACEJKA;
+  }});
+  cases.push_back({"dynamic, cte/epsi in cost", [](MPC& mpc) {
+    mpc.model.type = ModelConfig::DYNAMIC;
+    mpc.formulation.error_states = false;
+  }});
+  cases.push_back({"Heun integrator", [](MPC& mpc) {
+    mpc.model.integrator = ModelConfig::HEUN;
+  }});
+  cases.push_back({"RK4 integrator", [](MPC& mpc) {
+    mpc.model.integrator = ModelConfig::RUNGE_KUTTA;
+  }});
+  cases.push_back({"dynamic, RK4", [](MPC& mpc) {
+    mpc.model.type = ModelConfig::DYNAMIC;
+    mpc.model.integrator = ModelConfig::RUNGE_KUTTA;
+  }});
+
+  std::cout << std::left << std::setw(28) << "formulation" << std::right
+            << std::setw(10) << "mean ms" << std::setw(10) << "p50 ms"
+            << std::setw(10) << "p95 ms" << std::setw(10) << "max ms"
+            << std::setw(12) << "smooth us" << std::setw(14) << "mean cost" << std::endl;
+  for (const BenchCase& c : cases) {
+    run(c, scenarios);
+  }
+
+  KinematicModel kinematic;
+  DynamicModel linear, pacejka;
+  pacejka.tire = DynamicModel::PACEJKA;
+  std::cout << std::endl << std::left << std::setw(28) << "model" << std::right
+            << std::setw(12) << "deriv ns" << std::setw(12) << "jacobian ns"
+            << std::setw(14) << "jacobian err" << std::endl;
+  double error = time_model("kinematic", kinematic, scenarios);
+  error = std::max(error, time_model("dynamic, linear tires", linear, scenarios));
+  error = std::max(error, time_model("dynamic, Pacejka tires", pacejka, scenarios));
+  // Central differences with h = 1e-6 are good to about 1e-9
+  if (error > 1e-6) {
+    std::cerr << "Analytic Jacobian disagrees with deriv" << std::endl;
+    return 1;
+  }
+  return 0;
+}
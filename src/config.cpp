@@ -0,0 +1,332 @@
+#include "config.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+bool to_double(const std::string& s, double& value) {
+  char* end;
+  value = strtod(s.c_str(), &end);
+  return !s.empty() && *end == '\0';
+}
+
+bool to_int(const std::string& s, int& value) {
+  char* end;
+  long parsed = strtol(s.c_str(), &end, 10);
+  value = int(parsed);
+  return !s.empty() && *end == '\0';
+}
+
+bool invalid(const std::string& key, const std::string& value) {
+  std::cerr << "Invalid " << key << " " << value << std::endl;
+  return false;
+}
+
+}  // namespace
+
+ControllerConfig::ControllerConfig()
+    : speed_lookahead(200.0), racing_line_lookahead(60.0), actuation_delay(0.1), control_period(0.1), simulated_delay(0),
+      viz_every(1), log_every(1), port(4567) {
+  // The solver defaults are the solver's own
+  MPC mpc;
+  horizon = mpc.horizon;
+  adaptive = mpc.adaptive;
+  formulation = mpc.formulation;
+  warm_start = mpc.warm_start;
+  multistart = mpc.multistart;
+  smoothing = mpc.smoothing;
+  limits = mpc.limits;
+  objective = mpc.objective;
+  model = mpc.model;
+  speed_limits.max_speed = objective.ref_v;
+  speed_limits.lateral_accel = 8.0;
+  speed_limits.accel = 3.0;
+  speed_limits.decel = 6.0;
+}
+
+bool ControllerConfig::Set(const std::string& key, const std::string& value) {
+  const struct {
+    const char* key;
+    double* value;
+  } reals[] = {
+    {"weight-cte", &objective.cte},
+    {"weight-cte-steer", &objective.cte_steer},
+    {"weight-epsi", &objective.epsi},
+    {"weight-speed", &objective.speed},
+    {"weight-steer", &objective.steer},
+    {"weight-throttle", &objective.throttle},
+    {"weight-throttle-steer", &objective.throttle_steer},
+    {"weight-steer-rate", &objective.steer_rate},
+    {"weight-throttle-rate", &objective.throttle_rate},
+    {"min-throttle", &limits.min_throttle},
+    {"max-throttle", &limits.max_throttle},
+    {"lf", &model.kinematic.lf},
+    {"mass", &model.dynamic.mass},
+    {"yaw-inertia", &model.dynamic.iz},
+    {"cog-to-front", &model.dynamic.lf},
+    {"cog-to-rear", &model.dynamic.lr},
+    {"cornering-front", &model.dynamic.cf},
+    {"cornering-rear", &model.dynamic.cr},
+    {"pacejka-b", &model.dynamic.b},
+    {"pacejka-c", &model.dynamic.c},
+    {"friction", &model.dynamic.mu},
+    {"max-lateral-accel", &speed_limits.lateral_accel},
+    {"max-accel", &speed_limits.accel},
+    {"max-decel", &speed_limits.decel},
+    {"speed-lookahead", &speed_lookahead},
+    {"racing-line-lookahead", &racing_line_lookahead},
+    {"actuation-delay", &actuation_delay},
+    {"control-period", &control_period},
+  };
+  const struct {
+    const char* key;
+    int* value;
+  } integers[] = {
+    {"simulated-delay", &simulated_delay},
+    {"viz-every", &viz_every},
+    {"log-every", &log_every},
+    {"port", &port},
+    {"control-cpu", &runtime.control_cpu},
+    {"fifo", &runtime.fifo_priority},
+  };
+
+  for (const auto& r : reals) {
+    if (key == r.key) {
+      return to_double(value, *r.value) || invalid(key, value);
+    }
+  }
+  for (const auto& i : integers) {
+    if (key == i.key) {
+      return to_int(value, *i.value) || invalid(key, value);
+    }
+  }
+
+  bool ok = true;
+  double real;
+  int integer;
+  if (key == "N") {
+    ok = to_int(value, integer) && integer >= 2;
+    if (ok) {
+      horizon.N = integer;
+      horizon.segments.clear();
+    }
+  } else if (key == "dt") {
+    ok = to_double(value, real) && real > 0.0;
+    if (ok) {
+      horizon.dt = real;
+      horizon.segments.clear();
+    }
+  } else if (key == "grid") {
+    std::vector<GridSegment> segments;
+    ok = parse_grid(value, segments);
+    if (ok) {
+      horizon = make_blocked_horizon(segments);
+    }
+  } else if (key == "adaptive") {
+    // Per-tick solve budget in seconds, 0 for a fixed horizon
+    ok = to_double(value, real) && real >= 0.0;
+    adaptive.enabled = real > 0.0;
+    adaptive.budget = adaptive.enabled ? real : adaptive.budget;
+  } else if (key == "error-states") {
+    ok = to_int(value, integer);
+    formulation.error_states = integer != 0;
+  } else if (key == "transcription") {
+    if (value == "simultaneous") {
+      formulation.transcription = Formulation::SIMULTANEOUS;
+    } else if (value == "multiple") {
+      formulation.transcription = Formulation::MULTIPLE_SHOOTING;
+    } else if (value == "single") {
+      formulation.transcription = Formulation::SINGLE_SHOOTING;
+    } else {
+      ok = false;
+    }
+  } else if (key == "shooting-interval") {
+    ok = to_int(value, integer) && integer >= 1;
+    formulation.shooting_interval = integer;
+  } else if (key == "warm-start") {
+    ok = to_int(value, integer);
+    warm_start = integer != 0;
+  } else if (key == "multistart") {
+    // Threads, 1 to run the starts one after another and 0 to disable them
+    ok = to_int(value, integer) && integer >= 0;
+    multistart.enabled = integer > 0;
+    multistart.threads = std::max(integer, 1);
+  } else if (key == "model") {
+    if (value == "kinematic") {
+      model.type = ModelConfig::KINEMATIC;
+    } else if (value == "dynamic") {
+      model.type = ModelConfig::DYNAMIC;
+    } else {
+      ok = false;
+    }
+  } else if (key == "integrator") {
+    if (value == "euler") {
+      model.integrator = ModelConfig::EULER;
+    } else if (value == "heun") {
+      model.integrator = ModelConfig::HEUN;
+    } else if (value == "rk4") {
+      model.integrator = ModelConfig::RUNGE_KUTTA;
+    } else {
+      ok = false;
+    }
+  } else if (key == "tire") {
+    if (value == "linear") {
+      model.dynamic.tire = DynamicModel::LINEAR;
+    } else if (value == "pacejka") {
+      model.dynamic.tire = DynamicModel::PACEJKA;
+    } else {
+      ok = false;
+    }
+  } else if (key == "smoothing") {
+    if (value == "none") {
+      smoothing.filter = Smoothing::NONE;
+    } else if (value == "average") {
+      smoothing.filter = Smoothing::MOVING_AVERAGE;
+    } else if (value == "savgol") {
+      smoothing.filter = Smoothing::SAVITZKY_GOLAY;
+    } else {
+      ok = false;
+    }
+  } else if (key == "smoothing-window") {
+    ok = to_int(value, integer) && integer >= 1;
+    smoothing.window = integer;
+  } else if (key == "smoothing-order") {
+    ok = to_int(value, integer) && integer >= 0;
+    smoothing.order = integer;
+  } else if (key == "ref-v") {
+    // Miles per hour, like the simulator's speed
+    ok = to_double(value, real) && real >= 0.0;
+    objective.ref_v = real * 0.44704;
+    speed_limits.max_speed = objective.ref_v;
+  } else if (key == "max-steer") {
+    // Degrees
+    ok = to_double(value, real) && real > 0.0;
+    limits.max_steer = real * M_PI / 180;
+  } else if (key == "speed-profile") {
+    speed_profile_path = value;
+  } else if (key == "racing-line") {
+    racing_line_path = value;
+  } else if (key == "racing-line-spacing") {
+    ok = to_double(value, real) && real > 0.0;
+    if (ok) {
+      racing_line_options.spacing = real;
+    }
+  } else if (key == "racing-line-half-width") {
+    ok = to_double(value, real) && real >= 0.0;
+    if (ok) {
+      racing_line_options.half_width = real;
+    }
+  } else if (key == "policy") {
+    policy_path = value;
+  } else if (key == "record") {
+    record_path = value;
+  } else if (key == "worker-cpus") {
+    ok = parse_cpu_list(value, runtime.worker_cpus);
+  } else if (key == "mlock") {
+    ok = to_int(value, integer);
+    runtime.lock_memory = integer != 0;
+  } else if (key == "prefault-stack") {
+    // Kilobytes
+    ok = to_int(value, integer) && integer >= 0;
+    runtime.prefault_stack = size_t(integer) * 1024;
+  } else {
+    std::cerr << "Unknown setting " << key << std::endl;
+    return false;
+  }
+
+  return ok || invalid(key, value);
+}
+
+bool ControllerConfig::Load(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "Unable to open " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  int number = 0;
+  while (std::getline(in, line)) {
+    ++number;
+    std::istringstream fields(line);
+    std::string key;
+    std::string value;
+    if (!(fields >> key) || key[0] == '#') {
+      continue;
+    }
+    if (!(fields >> value) || !Set(key, value)) {
+      std::cerr << path << ":" << number << ": invalid setting" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+void ControllerConfig::Configure(MPC& mpc) const {
+  mpc.horizon = horizon;
+  mpc.adaptive = adaptive;
+  mpc.formulation = formulation;
+  mpc.warm_start = warm_start;
+  mpc.multistart = multistart;
+  mpc.smoothing = smoothing;
+  mpc.limits = limits;
+  mpc.objective = objective;
+  mpc.model = model;
+}
+
+bool ControllerConfig::Validate() const {
+  if (limits.min_throttle > limits.max_throttle) {
+    std::cerr << "min-throttle " << limits.min_throttle << " is above max-throttle "
+              << limits.max_throttle << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool load_config(int argc, char* argv[], ControllerConfig& config) {
+  // A flag without its value, or a stray argument, would shift every later pair
+  if (argc % 2 == 0) {
+    std::cerr << "Options come in --key value pairs, but " << argv[argc - 1]
+              << " is left over" << std::endl;
+    return false;
+  }
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::string(argv[i]) == "--config" && !config.Load(argv[i + 1])) {
+      return false;
+    }
+  }
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string flag = argv[i];
+    if (flag == "--config") {
+      continue;
+    }
+    if (flag.compare(0, 2, "--") != 0) {
+      std::cerr << "Unknown option " << flag << std::endl;
+      return false;
+    }
+    if (!config.Set(flag.substr(2), argv[i + 1])) {
+      return false;
+    }
+  }
+  return config.Validate();
+}
+
+bool parse_grid(const std::string& s, std::vector<GridSegment>& segments) {
+  std::istringstream in(s);
+  std::string run;
+  while (std::getline(in, run, ',')) {
+    GridSegment seg;
+    char x, slash;
+    std::istringstream rin(run);
+    if (!(rin >> seg.steps >> x >> seg.dt >> slash >> seg.hold) || x != 'x' ||
+        slash != '/' || seg.steps == 0 || seg.dt <= 0 || seg.hold == 0) {
+      return false;
+    }
+    segments.push_back(seg);
+  }
+  return !segments.empty();
+}
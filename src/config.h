@@ -0,0 +1,92 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+#include "MPC.h"
+#include "racing_line.h"
+#include "runtime.h"
+#include "speed_profile.h"
+
+//
+// Settings of the controller, read at startup from an optional file and
+// overridden from the command line.
+//
+// The file holds one `key value` pair per line; blank lines and lines
+// starting with '#' are skipped. On the command line every key is a flag,
+// `--key value`, and `--config path` names the file. See mpc.conf for the
+// keys and their defaults.
+//
+// A loaded configuration is only ever shared as a pointer to const. A
+// reload (SIGHUP) loads a new one and builds a new solver from it. The
+// port, policy, record and real-time settings only take effect at startup.
+//
+struct ControllerConfig {
+  // Defaults of every setting
+  ControllerConfig();
+
+  // Solver
+  Horizon horizon;
+  AdaptiveHorizon adaptive;
+  Formulation formulation;
+  bool warm_start;
+  MultiStart multistart;
+  Smoothing smoothing;
+  ActuatorLimits limits;
+  Objective objective;
+  ModelConfig model;
+
+  // Speed profile: waypoints to compute it from (none to drive at ref-v),
+  // its limits (the top speed is ref-v) and how far ahead it is sampled (m)
+  std::string speed_profile_path;
+  SpeedLimits speed_limits;
+  double speed_lookahead;
+
+  // Path to follow instead of the simulator's waypoints, such as a racing
+  // line written by optimize_line (none to follow the waypoints), and how
+  // far ahead of the car it is fitted (m)
+  std::string racing_line_path;
+  double racing_line_lookahead;
+  // How optimize_line computes the racing line
+  RacingLineOptions racing_line_options;
+
+  // Control loop
+  double actuation_delay;
+  double control_period;
+  int simulated_delay;
+  int viz_every;
+  // Per-tick state and solver log every k ticks, 0 for none
+  int log_every;
+
+  // Startup only
+  int port;
+  std::string policy_path;
+  std::string record_path;
+  RuntimeConfig runtime;
+
+  // Sets one setting. Prints the problem and returns false for an unknown
+  // key or an invalid value.
+  bool Set(const std::string& key, const std::string& value);
+
+  // Sets every pair read from the file. Returns false if it cannot be read
+  // or any line is invalid.
+  bool Load(const std::string& path);
+
+  // Checks the settings that constrain each other. Prints the problem and
+  // returns false if they cannot make a sensible solver.
+  bool Validate() const;
+
+  // Copies the solver settings into mpc.
+  void Configure(MPC& mpc) const;
+};
+
+// Loads the file given with --config, if any, then applies every other
+// `--key value` pair of the command line in order and validates the result.
+// Returns false on an odd number of arguments or any invalid setting.
+bool load_config(int argc, char* argv[], ControllerConfig& config);
+
+// Parses a grid description such as "8x0.05/1,4x0.1/2,2x0.2/2", i.e. comma
+// separated runs of <steps>x<dt>/<hold>.
+bool parse_grid(const std::string& s, std::vector<GridSegment>& segments);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,50 @@
+#include "latency.h"
+#include <algorithm>
+#include <cmath>
+
+//
+// LatencyEstimator class definition implementation.
+//
+LatencyEstimator::LatencyEstimator(double actuation_delay, double alpha)
+    : actuation_delay(actuation_delay), alpha_(alpha),
+      has_arrival_(false), pending_(false),
+      interarrival_(0.0), solve_time_(0.0), response_time_(0.0), jitter_(0.0),
+      solves_(0), samples_(0) {}
+
+void LatencyEstimator::update(double& average, double sample, bool first) const {
+  average = first ? sample : average + alpha_ * (sample - average);
+}
+
+void LatencyEstimator::OnTelemetry(Clock::time_point now) {
+  if (has_arrival_) {
+    double dt = std::chrono::duration<double>(now - last_arrival_).count();
+    update(interarrival_, dt, interarrival_ == 0.0);
+  }
+  last_arrival_ = now;
+  has_arrival_ = true;
+  pending_ = true;
+}
+
+void LatencyEstimator::OnSolve(double seconds) {
+  update(solve_time_, seconds, solves_ == 0);
+  ++solves_;
+}
+
+LatencyEstimator::Clock::time_point LatencyEstimator::NextArrival(double max_period) const {
+  double period = interarrival_ > 0.0 ? std::min(interarrival_, max_period) : max_period;
+  Clock::time_point from = has_arrival_ ? last_arrival_ : Clock::now();
+  return from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(period));
+}
+
+void LatencyEstimator::OnCommandSent(Clock::time_point now) {
+  // Only the first command after a telemetry frame is a response to it
+  if (!pending_) {
+    return;
+  }
+  pending_ = false;
+
+  double response = std::chrono::duration<double>(now - last_arrival_).count();
+  update(jitter_, fabs(response - response_time_), samples_ == 0);
+  update(response_time_, response, samples_ == 0);
+  ++samples_;
+}
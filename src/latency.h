@@ -0,0 +1,62 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <chrono>
+
+//
+// Online estimate of the control loop delay.
+//
+// Timestamps telemetry arrival and command send, and tracks the
+// inter-arrival time, the solve time and the response time (arrival to
+// send) with exponentially weighted moving averages. The latency handed to
+// the state predictor is the response time plus the actuation delay on the
+// plant side, which cannot be observed from here.
+//
+class LatencyEstimator {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // alpha is the weight of each new sample in the moving averages
+  explicit LatencyEstimator(double actuation_delay, double alpha = 0.1);
+
+  // Delay (seconds) between a command being sent and it taking effect
+  double actuation_delay;
+
+  void OnTelemetry(Clock::time_point now = Clock::now());
+  void OnSolve(double seconds);
+  void OnCommandSent(Clock::time_point now = Clock::now());
+
+  // Expected delay (seconds) between a telemetry sample and its command taking effect
+  double latency() const { return actuation_delay + response_time_; }
+
+  // Smoothed estimates in seconds
+  double interarrival() const { return interarrival_; }
+  double solve_time() const { return solve_time_; }
+  double response_time() const { return response_time_; }
+  // Smoothed absolute deviation of the response time
+  double jitter() const { return jitter_; }
+
+  unsigned long samples() const { return samples_; }
+
+  // Expected arrival of the next telemetry frame: the last arrival plus the
+  // smoothed inter-arrival time, at most `max_period` seconds
+  Clock::time_point NextArrival(double max_period) const;
+
+ private:
+  void update(double& average, double sample, bool first) const;
+
+  double alpha_;
+
+  Clock::time_point last_arrival_;
+  bool has_arrival_;
+  bool pending_;
+
+  double interarrival_;
+  double solve_time_;
+  double response_time_;
+  double jitter_;
+  unsigned long solves_;
+  unsigned long samples_;
+};
+
+#endif /* LATENCY_H */
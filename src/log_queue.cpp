@@ -0,0 +1,61 @@
+#include "log_queue.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <chrono>
+
+//
+// LogQueue class definition implementation.
+//
+LogQueue::LogQueue(size_t capacity)
+    : capacity_(capacity), lines_(capacity * kLineSize), head_(0), tail_(0), stop_(false),
+      dropped_(0) {}
+
+LogQueue::~LogQueue() {
+  stop_ = true;
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  Drain();
+}
+
+void LogQueue::Start() {
+  if (!writer_.joinable()) {
+    writer_ = std::thread([this]() { Run(); });
+  }
+}
+
+void LogQueue::Printf(const char* format, ...) {
+  size_t head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) == capacity_) {
+    ++dropped_;
+    return;
+  }
+  char* line = &lines_[(head % capacity_) * kLineSize];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line, kLineSize, format, args);
+  va_end(args);
+  head_.store(head + 1, std::memory_order_release);
+}
+
+void LogQueue::Run() {
+  while (!stop_) {
+    if (!Drain()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+}
+
+bool LogQueue::Drain() {
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  size_t head = head_.load(std::memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+  for (; tail != head; ++tail) {
+    puts(&lines_[(tail % capacity_) * kLineSize]);
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+  fflush(stdout);
+  return true;
+}
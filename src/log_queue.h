@@ -0,0 +1,54 @@
+#ifndef LOG_QUEUE_H
+#define LOG_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+//
+// Moves console logging off the control thread.
+//
+// The control thread formats each line into a preallocated slot of a
+// single-producer, single-consumer ring and returns; a writer thread of its
+// own prints the lines to stdout. Logging therefore never blocks, allocates
+// or flushes on the control thread. When the writer falls behind the ring
+// fills up and further lines are dropped (and counted) rather than waited
+// for.
+//
+// Only one thread may call Printf.
+//
+class LogQueue {
+ public:
+  explicit LogQueue(size_t capacity = 64);
+  // Prints whatever is still queued and stops the writer
+  ~LogQueue();
+
+  // Starts the writer thread. Call it before pinning the calling thread, so
+  // that the writer does not inherit its core.
+  void Start();
+
+  // Queues one line, printf-style, truncated to kLineSize - 1 characters
+  void Printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+  // Lines dropped because the queue was full
+  unsigned long dropped() const { return dropped_; }
+
+  static const size_t kLineSize = 512;
+
+ private:
+  void Run();
+  // Prints the queued lines. Returns false if there were none.
+  bool Drain();
+
+  const size_t capacity_;
+  std::vector<char> lines_;
+  // Lines written by the producer and printed by the writer, so far
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+  std::atomic<bool> stop_;
+  std::atomic<unsigned long> dropped_;
+  std::thread writer_;
+};
+
+#endif /* LOG_QUEUE_H */
@@ -1,13 +1,28 @@
 #include <math.h>
+#include <stdio.h>
 #include <uWS/uWS.h>
+#include <atomic>
+#include <cmath>
 #include <chrono>
+#include <csignal>
 #include <iostream>
+#include <memory>
 #include <thread>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
 #include "Eigen-3.3/Eigen/QR"
 #include "MPC.h"
+#include "config.h"
 #include "json.hpp"
+#include "latency.h"
+#include "log_queue.h"
+#include "policy.h"
+#include "predictor.h"
+#include "runtime.h"
+#include "socketio.h"
+#include "speed_profile.h"
+#include "track_path.h"
+#include "wire.h"
 
 // for convenience
 using json = nlohmann::json;
@@ -17,28 +32,15 @@ constexpr double pi() { return M_PI; }
 double deg2rad(double x) { return x * pi() / 180; }
 double rad2deg(double x) { return x * 180 / pi(); }
 
-const double latency = 0.1;
-
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-string hasData(string s) {
-  auto found_null = s.find("null");
-  auto b1 = s.find_first_of("[");
-  auto b2 = s.rfind("}]");
-  if (found_null != string::npos) {
-    return "";
-  } else if (b1 != string::npos && b2 != string::npos) {
-    return s.substr(b1, b2 - b1 + 2);
-  }
-  return "";
-}
+// uWS user data of the connections that negotiated the binary wire format
+// (see wire.h); NULL on JSON connections
+char binary_format;
 
 
 // Fit a polynomial.
 // Adapted from
 // https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
+Eigen::VectorXd polyfit(const VectorRef& xvals, const VectorRef& yvals,
                         int order) {
   assert(xvals.size() == yvals.size());
   assert(order >= 1 && order <= xvals.size() - 1);
@@ -59,12 +61,17 @@ Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals,
   return result;
 }
 
-Eigen::VectorXd toVectorXd(vector<double> v){
-  Eigen::VectorXd vxd(v.size());
-  for(unsigned int i = 0; i < vxd.size(); ++i){
-    vxd(i) = v[i];
+// Views the values as an Eigen vector without copying them
+Eigen::Map<const Eigen::VectorXd> asVectorXd(const vector<double>& v){
+  return Eigen::Map<const Eigen::VectorXd>(v.data(), v.size());
+}
+
+json json_array(const Span<double>& values) {
+  json array = json::array();
+  for (double v : values) {
+    array.push_back(v);
   }
-  return vxd;
+  return array;
 }
 
 
@@ -84,168 +91,416 @@ void to_vehicle_coords(vector<double> &xs, vector<double> &ys, double px, double
     }
 }
 
-int main() {
+// Set from the SIGHUP handler and polled by the control loop
+volatile sig_atomic_t reload_requested = 0;
+
+void request_reload(int) { reload_requested = 1; }
+
+// The solver and the controller around it, built from one configuration and
+// replaced as a whole when the configuration is reloaded. The solver workers
+// take the real-time settings the process started with.
+struct Pipeline {
+  std::shared_ptr<const ControllerConfig> config;
+  MPC mpc;
+  PolicyController controller;
+  // Empty without a speed-profile or racing-line
+  SpeedProfile profile;
+  TrackPath line;
+
+  Pipeline(const std::shared_ptr<const ControllerConfig>& config, const PolicyNet* net,
+           PolicyRecorder* recorder, const RuntimeConfig& runtime)
+      : config(config), controller(mpc, net, recorder) {
+    config->Configure(mpc);
+    mpc.multistart.thread_setup = [runtime](size_t number) {
+      apply_thread_config(runtime, number);
+    };
+    controller.tracker.limits = mpc.limits;
+    controller.tracker.target_speed = mpc.objective.ref_v;
+  }
+};
+
+// Builds the pipeline of a configuration, or returns null if its speed
+// profile or racing line cannot be loaded.
+std::shared_ptr<Pipeline> make_pipeline(const std::shared_ptr<const ControllerConfig>& config,
+                                        const PolicyNet* net, PolicyRecorder* recorder,
+                                        const RuntimeConfig& runtime) {
+  std::shared_ptr<Pipeline> pipeline = std::make_shared<Pipeline>(config, net, recorder, runtime);
+  if (!config->speed_profile_path.empty() &&
+      !pipeline->profile.Load(config->speed_profile_path, config->speed_limits)) {
+    return std::shared_ptr<Pipeline>();
+  }
+  if (!config->racing_line_path.empty() && !pipeline->line.Load(config->racing_line_path)) {
+    return std::shared_ptr<Pipeline>();
+  }
+  return pipeline;
+}
+
+int main(int argc, char* argv[]) {
   uWS::Hub h;
 
+  // Every setting can be read from a file of `key value` lines (see
+  // mpc.conf for all of them and their defaults) and given on the command
+  // line as `--key value`, which overrides the file:
+  //   ./mpc --config mpc.conf --ref-v 80
+  // Sending the process SIGHUP reads both again and swaps in a solver built
+  // from them at the next telemetry frame.
+  //
+  // Optional approximate policy, training data export and adaptive horizon
+  // with a per-tick solve budget in seconds:
+  //   ./mpc --policy weights.txt --record samples.csv --adaptive 0.05
+  // or a fixed move-blocked grid (see parse_grid in config.h):
+  //   ./mpc --grid 8x0.05/1,4x0.1/2,2x0.2/2
+  // and cte/epsi evaluated in the cost rather than carried as states:
+  //   ./mpc --error-states 0
+  // Transcription (simultaneous, multiple or single shooting) and warm start:
+  //   ./mpc --transcription multiple --shooting-interval 5 --warm-start 1
+  // Multi-start solves on the given number of threads (1 runs the starts
+  // one after another, 0 disables them):
+  //   ./mpc --multistart 4
+  // Post-solve smoothing of the actuations (none, average or savgol), its
+  // window in intervals and the Savitzky-Golay polynomial degree:
+  //   ./mpc --smoothing savgol --smoothing-window 7 --smoothing-order 2
+  // Real-time settings: cores of the control thread and of the solver
+  // workers, SCHED_FIFO priority, memory locking and stack pre-faulting (KB):
+  //   ./mpc --control-cpu 1 --worker-cpus 2,3,4 --fifo 80 --mlock 1 --prefault-stack 512
+  // Trajectory visualisation in the responses: every tick (1, default), every
+  // k-th tick (k) or never (0, steering and throttle only):
+  //   ./mpc --viz-every 0
+  // Per-tick log (written by a separate thread) every k-th tick, or never:
+  //   ./mpc --log-every 10
+  // Delay (seconds) between sending a command and it taking effect, on top
+  // of the measured response time, and an artificial delay (milliseconds)
+  // before each command is sent to mimic a slower loop:
+  //   ./mpc --actuation-delay 0.1 --simulated-delay 100
+  // Dynamic bicycle model with saturating tires instead of the kinematic one:
+  //   ./mpc --model dynamic --tire pacejka
+  // Fourth-order Runge-Kutta instead of Euler steps in the solver:
+  //   ./mpc --integrator rk4
+  // Speed profile along the track and a racing line to follow (see
+  // optimize_line.cpp):
+  //   ./mpc --speed-profile racing_line.bin --racing-line racing_line.bin
+  // Longest time (seconds) between telemetry frames; the solver must return
+  // before the next frame is expected:
+  //   ./mpc --control-period 0.1
+  std::shared_ptr<ControllerConfig> config = std::make_shared<ControllerConfig>();
+  if (!load_config(argc, argv, *config)) {
+    return -1;
+  }
+  const RuntimeConfig runtime = config->runtime;
+
+  // Console output of the control loop, written by a thread of its own that
+  // is started before the control thread is pinned, so it runs elsewhere
+  LogQueue log;
+  log.Start();
+
+  // The control thread is the one running the event loop below
+  apply_process_config(runtime);
+  apply_thread_config(runtime, 0);
+
+  PolicyNet net;
+  if (!config->policy_path.empty() && !net.Load(config->policy_path)) {
+    return -1;
+  }
+  std::unique_ptr<PolicyRecorder> recorder;
+  if (!config->record_path.empty()) {
+    recorder.reset(new PolicyRecorder(config->record_path));
+    if (!recorder->is_open()) {
+      std::cerr << "Unable to open " << config->record_path << std::endl;
+      return -1;
+    }
+  }
+
   // MPC is initialized here!
-  MPC mpc;
+  std::shared_ptr<Pipeline> active = make_pipeline(config, &net, recorder.get(), runtime);
+  if (!active) {
+    return -1;
+  }
 
-  h.onMessage([&mpc](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-                     uWS::OpCode opCode) {
-    // "42" at the start of the message means there's a websocket message event.
-    // The 4 signifies a websocket message
-    // The 2 signifies a websocket event
-    string sdata = string(data).substr(0, length);
-    cout << sdata << endl;
-    if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2') {
-      string s = hasData(sdata);
-      if (s != "") {
-        auto j = json::parse(s);
-        string event = j[0].get<string>();
-        if (event == "telemetry") {
-          // j[1] is the data JSON object
-          vector<double> ptsx = j[1]["ptsx"];
-          vector<double> ptsy = j[1]["ptsy"];
-          double px = j[1]["x"];
-          double py = j[1]["y"];
-          double psi = j[1]["psi"];
-          double v = j[1]["speed"];
-          
-          // We convert from miles per hour to meters per second
-          v = v * 0.44704;          
-
-          to_vehicle_coords(ptsx, ptsy, px, py, psi);
-          // Now px and py become 0 since they are the center of the system
-          px = 0.0;
-          py = 0.0;   
-          // Same for psi as we have rotated our coordinate system by psi
-          psi = 0.0;       
-                                                 
-          // First step is to compute the polynomial coefficients given ptsx and ptsy
-          Eigen::VectorXd vx = toVectorXd(ptsx);
-          Eigen::VectorXd vy = toVectorXd(ptsy);    
-
-          auto coeffs = polyfit(vx, vy, 3);          
-                            
-          // Get the predicted y based on the polynomial we calculated above
-          // double fx = polyeval(coeffs, px);
-          double fx = coeffs[0] + coeffs[1] * px + coeffs[2] * (px * px) + coeffs[3] * (px * px * px);
-          // CTE is just the difference between our predicted y and the vehicle's actual y
-          double cte = fx - py;
-
-
-          // Compute the derivative at point x 
-          // double fprime_x = poly_der(coeffs, px);
-          double fprime_x = coeffs[1] + 2 * coeffs[2] * px + 3 * coeffs[3] * (px * px);
-          // And use it to calculate the desired angle psi
-          double desired_psi = -atan(fprime_x);
-          // Now the error for psi is the difference between the current psi and our derired psi
-          double epsi = psi - desired_psi;
-
-
-          // Since we incur a delay of 100ms before the actuator runs,
-          // we need to take this into account. This means our vehicle 
-          // has actually moved in the last 100 milliseconds.
-          // Therefore we must recompute its state 100ms later
-          double a = j[1]["throttle"];
-          double delta = j[1]["steering_angle"];
-          // Remember that negative value means left turn,
-          // while a positive one means right turn.
-          delta *= -1;
-
-          px += v * cos(delta) * latency;
-          py += v * sin(delta) * latency;
-          
-          // Likewise, we must recompute the rest of the state
-          cte = cte + v * sin(epsi) * latency;
-          epsi = epsi + (v / 2.67) * latency;
-          psi += (v / 2.67) * delta *  latency;
-          v +=  a * latency;
-
-          // We can now create our state vector
-          Eigen::VectorXd state(6);
-
-          // Here our angle psi is naturally 0 as we have moved the waypoints
-          // to the car's coordinate system and orientation
-          // Also since we moved to car coordinate system, x and y are 0
-          state << px, py, psi, v, cte, epsi;
-
-          cout << "State is " << state[0] << ","
-                              << state[1] << ","
-                              << state[2] << ","
-                              << state[3] << ","
-                              << state[4] << ","
-                              << state[5]
-                              << endl;          
-
-          /*
-          * TODO: Calculate steering angle and throttle using MPC.
-          *
-          * Both are in between [-1, 1].
-          *
-          */
-          auto res = mpc.Solve(state, coeffs);
-          
-          double steer_value;
-          double throttle_value;
-          
-          // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
-          // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
-          steer_value = res.next_steering_angle() / deg2rad(25.0);
-          throttle_value = res.next_throttle();
-
-          cout << "MPC round done [cost=" << res.cost
-               << ", cte=" << res.cte
-               << ", steer=" << steer_value
-               << ", throttle=" << throttle_value
-               << "]" << endl;
-          
-          json msgJson;          
-          msgJson["steering_angle"] = steer_value;
-          msgJson["throttle"] = throttle_value;
-
-          //Display the MPC predicted trajectory 
-          vector<double> mpc_x_vals = res.predicted_xs;
-          vector<double> mpc_y_vals = res.predicted_ys;
-
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Green line
-          // to_vehicle_coords(mpc_x_vals, mpc_y_vals, px, py, psi);
-          msgJson["mpc_x"] = mpc_x_vals;
-          msgJson["mpc_y"] = mpc_y_vals;
-
-          //Display the waypoints/reference line                    
-          vector<double> next_x_vals = ptsx;
-          vector<double> next_y_vals = ptsy;
-          
-          //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-          // the points in the simulator are connected by a Yellow line
-          msgJson["next_x"] = ptsx;
-          msgJson["next_y"] = ptsy;
-
-          auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-          // std::cout << msg << std::endl;
-
-          // Latency
-          // The purpose is to mimic real driving conditions where
-          // the car does actuate the commands instantly.
-          //
-          // Feel free to play around with this value but should be to drive
-          // around the track with 100ms latency.
-          //
-          // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-          // SUBMITTING.
-          // this_thread::sleep_for(chrono::milliseconds(100));
-
-          ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-        }
+  // A reload parses the configuration and builds the new pipeline on its own
+  // thread, then publishes it for the control loop to swap in between two
+  // frames. The solver in use is never touched from another thread.
+  std::shared_ptr<Pipeline> pending;
+  std::atomic<bool> loading(false);
+  std::thread loader;
+  auto reload = [&]() {
+    reload_requested = 0;
+    loading = true;
+    if (loader.joinable()) {
+      loader.join();
+    }
+    loader = std::thread([&]() {
+      std::shared_ptr<ControllerConfig> next = std::make_shared<ControllerConfig>();
+      std::shared_ptr<Pipeline> pipeline;
+      if (load_config(argc, argv, *next)) {
+        pipeline = make_pipeline(next, &net, recorder.get(), runtime);
+      }
+      if (pipeline) {
+        std::atomic_store(&pending, pipeline);
       } else {
-        // Manual driving
-        std::string msg = "42[\"manual\",{}]";
-        ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+        std::cerr << "Keeping the current configuration" << std::endl;
       }
+      loading = false;
+    });
+  };
+  signal(SIGHUP, request_reload);
+
+  // Manual driving: a null payload means the simulator is in manual mode
+  auto manual = [](const Packet& packet, const SocketIO::Sender& send) {
+    std::string msg = make_event("manual", "{}", packet.nsp);
+    send(msg.data(), msg.length());
+  };
+
+  SocketIO io;
+  io.OnUnhandled([&manual](const Packet& packet, const SocketIO::Sender& send) {
+    if (packet.payload.empty() || packet.payload[0] != '{') {
+      manual(packet, send);
     }
   });
+  // Runs one control step: telemetry in, actuation and trajectories out.
+  // Shared by the JSON and binary wire formats. The trajectories are only
+  // filled in on the ticks selected by --viz-every.
+  unsigned long tick = 0;
+  StatePredictor predictor;
+  predictor.model = config->model;
+  // Reused every tick; the command's trajectories point into it
+  MPCResult res;
+  LatencyEstimator latency(config->actuation_delay);
+  auto drive = [&active, &pending, &loading, &reload, &tick, &predictor, &latency,
+                &res, &log](Telemetry& t, SteerCommand& cmd) {
+    auto start = std::chrono::steady_clock::now();
+
+    if (reload_requested && !loading) {
+      reload();
+    }
+    std::shared_ptr<Pipeline> next = std::atomic_exchange(&pending, std::shared_ptr<Pipeline>());
+    if (next) {
+      PolicyController& previous = active->controller;
+      next->controller.approximated = previous.approximated;
+      next->controller.solved = previous.solved;
+      next->controller.shifted = previous.shifted;
+      next->controller.tracked = previous.tracked;
+      active = next;
+      predictor.model = active->config->model;
+      latency.actuation_delay = active->config->actuation_delay;
+      cout << "Configuration reloaded" << endl;
+    }
+    const ControllerConfig& config = *active->config;
+    MPC& mpc = active->mpc;
+    PolicyController& controller = active->controller;
+
+    vector<double>& ptsx = t.ptsx;
+    vector<double>& ptsy = t.ptsy;
+    double px = t.x;
+    double py = t.y;
+    double psi = t.psi;
+    double v = t.speed;
+
+    // Points of the racing line around the car replace the waypoints: one
+    // every 10m from 10m behind
+    const TrackPath& line = active->line;
+    if (!line.empty()) {
+      const double spacing = 10.0;
+      double s = line.Locate(px, py) - spacing;
+      size_t n = size_t(config.racing_line_lookahead / spacing) + 2;
+      ptsx.resize(n);
+      ptsy.resize(n);
+      for (size_t k = 0; k < n; ++k) {
+        line.PointAt(s + k * spacing, ptsx[k], ptsy[k]);
+      }
+    }
+
+    // Reference speeds ahead of the car, from the closest point of the track
+    const SpeedProfile& profile = active->profile;
+    if (!profile.empty()) {
+      SpeedReference& reference = mpc.speed_reference;
+      reference.ds = 1.0;
+      profile.Sample(profile.Locate(px, py), reference.ds,
+                     size_t(config.speed_lookahead / reference.ds) + 1, reference.speeds);
+      // The fallback tracker brakes for the corners too
+      controller.tracker.target_speed = reference.speeds.front();
+    }
+
+    // We convert from miles per hour to meters per second
+    v = v * 0.44704;          
+
+    to_vehicle_coords(ptsx, ptsy, px, py, psi);
+    // Now the vehicle is the center of the system and, as we have rotated
+    // our coordinate system by psi, it is heading along x
+
+    // First step is to compute the polynomial coefficients given ptsx and ptsy
+    auto vx = asVectorXd(ptsx);
+    auto vy = asVectorXd(ptsy);
+
+    auto coeffs = polyfit(vx, vy, 3);          
+
+    // Since we incur a delay before the actuator runs, we need to take this
+    // into account: by the time our command applies, the vehicle has moved
+    // on under the actuation it currently has. The delay is the configured
+    // actuation delay plus the measured time from telemetry to command.
+    double a = t.throttle;
+    double delta = t.steering_angle;
+
+    // The prediction starts from x = y = psi = 0 in the car's coordinate system
+    VehicleState state = predictor.Predict(v, delta, a, latency.latency(), coeffs);
+
+    // Every --log-every ticks, through the log thread
+    bool logged = config.log_every > 0 && tick % config.log_every == 0;
+    if (logged) {
+      log.Printf("State is %g,%g,%g,%g,%g,%g", state[0], state[1], state[2], state[3],
+                 state[4], state[5]);
+    }
+
+    /*
+    * TODO: Calculate steering angle and throttle using MPC.
+    *
+    * Both are in between [-1, 1].
+    *
+    */
+    controller.Control(state, coeffs, latency.NextArrival(config.control_period), res);
+
+    double steer_value;
+    double throttle_value;
+
+    // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
+    // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
+    steer_value = res.next_steering_angle() / deg2rad(25.0);
+    throttle_value = res.next_throttle();
+
+    if (logged) {
+      log.Printf("MPC round done [cost=%g, approximated=%lu, solved=%lu, shifted=%lu, "
+                 "tracked=%lu, N=%zu, dt=%g, quality=%d, cte=%g, steer=%g, throttle=%g, "
+                 "latency=%g, response=%g, jitter=%g, solve=%g, smoothing=%g, "
+                 "interarrival=%g]",
+                 res.cost, controller.approximated, controller.solved, controller.shifted,
+                 controller.tracked, mpc.horizon.N, mpc.horizon.dt, int(res.quality), res.cte,
+                 steer_value, throttle_value, latency.latency(), latency.response_time(),
+                 latency.jitter(), latency.solve_time(), mpc.SmoothingTime(),
+                 latency.interarrival());
+    }
+
+    cmd.steering_angle = steer_value;
+    cmd.throttle = throttle_value;
+    latency.OnSolve(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    // Latency
+    // The purpose is to mimic real driving conditions where
+    // the car does actuate the commands instantly. The delay is part of the
+    // measured response time, so the predictor accounts for it.
+    //
+    // Feel free to play around with this value but should be to drive
+    // around the track with 100ms latency.
+    if (config.simulated_delay > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(config.simulated_delay));
+    }
+
+    bool viz = config.viz_every > 0 && tick++ % config.viz_every == 0;
+    if (!viz) {
+      return;
+    }
+
+    //Display the MPC predicted trajectory 
+    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+    // the points in the simulator are connected by a Green line
+    cmd.mpc_x = res.xs();
+    cmd.mpc_y = res.ys();
+
+    //Display the waypoints/reference line                    
+    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+    // the points in the simulator are connected by a Yellow line
+    cmd.next_x = ptsx;
+    cmd.next_y = ptsy;
+  };
+
+  io.On("telemetry", [&drive, &manual, &latency](const Packet& packet, const SocketIO::Sender& send) {
+    latency.OnTelemetry();
+    const StrSpan& payload = packet.payload;
+    if (payload.empty() || payload[0] != '{') {
+      manual(packet, send);
+      return;
+    }
+    auto j = json::parse(payload.begin(), payload.end());
+
+    // j is the data JSON object
+    Telemetry t;
+    t.ptsx = j["ptsx"].get<vector<double> >();
+    t.ptsy = j["ptsy"].get<vector<double> >();
+    t.x = j["x"];
+    t.y = j["y"];
+    t.psi = j["psi"];
+    t.speed = j["speed"];
+    t.steering_angle = j["steering_angle"];
+    t.throttle = j["throttle"];
+
+    SteerCommand cmd;
+    drive(t, cmd);
+
+    string msg;
+    if (cmd.mpc_x.empty() && cmd.next_x.empty() && std::isfinite(cmd.steering_angle) &&
+        std::isfinite(cmd.throttle)) {
+      // Controls only: format directly rather than building a JSON document.
+      // %g would print nan or inf, which is not JSON; the document below
+      // writes null for those.
+      char body[96];
+      int n = snprintf(body, sizeof(body), "{\"steering_angle\":%.17g,\"throttle\":%.17g}",
+                       cmd.steering_angle, cmd.throttle);
+      msg = make_event("steer", StrSpan(body, n), packet.nsp);
+    } else {
+      json msgJson;          
+      msgJson["steering_angle"] = cmd.steering_angle;
+      msgJson["throttle"] = cmd.throttle;
+      msgJson["mpc_x"] = json_array(cmd.mpc_x);
+      msgJson["mpc_y"] = json_array(cmd.mpc_y);
+      msgJson["next_x"] = json_array(cmd.next_x);
+      msgJson["next_y"] = json_array(cmd.next_y);
+      msg = make_event("steer", msgJson.dump(), packet.nsp);
+    }
+    // std::cout << msg << std::endl;
+
+    send(msg.data(), msg.length());
+    latency.OnCommandSent();
+  });
+
+  h.onMessage([&io, &drive, &latency](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
+                            uWS::OpCode opCode) {
+    // Binary frames use the packed wire format instead of Socket.IO/JSON
+    if (opCode == uWS::OpCode::BINARY) {
+      WireHeader header;
+      if (!wire_read_header(data, length, header)) {
+        std::cerr << "Dropping unsupported binary frame" << std::endl;
+        return;
+      }
+      string msg;
+      if (header.type == WIRE_HELLO) {
+        // The connection switches to the binary format until it closes
+        ws.setUserData(&binary_format);
+        wire_encode_hello(msg);
+      } else {
+        if (ws.getUserData() != &binary_format) {
+          std::cerr << "Dropping binary telemetry before HELLO" << std::endl;
+          return;
+        }
+        latency.OnTelemetry();
+        Telemetry t;
+        if (!wire_decode_telemetry(data, length, t)) {
+          std::cerr << "Dropping malformed binary telemetry" << std::endl;
+          return;
+        }
+        SteerCommand cmd;
+        drive(t, cmd);
+        wire_encode_steer(cmd, msg);
+      }
+      ws.send(msg.data(), msg.size(), uWS::OpCode::BINARY);
+      latency.OnCommandSent();
+      return;
+    }
+
+    // The frame is only viewed in place: uWS does not NUL-terminate it, and
+    // the event name and payload are spans into the same buffer.
+    StrSpan sdata(data, length);
+    io.Dispatch(sdata, [&ws](const char* msg, size_t size) {
+      ws.send(msg, size, uWS::OpCode::TEXT);
+    });
+  });
 
   // We don't need this since we're not using HTTP but if it's removed the
   // program
@@ -262,6 +517,8 @@ int main() {
   });
 
   h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+    // JSON until the client negotiates the binary format with a HELLO
+    ws.setUserData(NULL);
     std::cout << "Connected!!!" << std::endl;
   });
 
@@ -271,7 +528,7 @@ int main() {
     std::cout << "Disconnected" << std::endl;
   });
 
-  int port = 4567;
+  int port = config->port;
   if (h.listen(port)) {
     std::cout << "Listening to port " << port << std::endl;
   } else {
@@ -279,4 +536,8 @@ int main() {
     return -1;
   }
   h.run();
+
+  if (loader.joinable()) {
+    loader.join();
+  }
 }
@@ -0,0 +1,81 @@
+// Offline racing line optimisation.
+//
+// Reads the centre line of a closed track, computes its minimum curvature
+// racing line (see racing_line.h) and writes it as a binary path file for
+// the controller's --racing-line and --speed-profile settings. Reports the
+// length, the tightest corner and the lap time at the profile speed of both
+// lines.
+//
+//   ./optimize_line lake_track_waypoints.csv racing_line.bin [--config mpc.conf]
+//       [--racing-line-half-width 2.5] [--racing-line-spacing 2] [--ref-v 70]
+//       [--max-lateral-accel 8] [--max-accel 3] [--max-decel 6]
+//
+// The settings are those of the controller (see config.h), so the profile
+// speeds match the ones it drives at.
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "racing_line.h"
+#include "speed_profile.h"
+
+namespace {
+
+// Radius (m) of the tightest corner
+double min_radius(const TrackPath& path) {
+  double kappa = 0.0;
+  for (size_t i = 0; i < path.size(); ++i) {
+    kappa = std::max(kappa, path.Curvature(i));
+  }
+  return kappa > 0.0 ? 1.0 / kappa : INFINITY;
+}
+
+void report(const std::string& name, const TrackPath& path, const SpeedLimits& limits) {
+  SpeedProfile profile;
+  profile.Compute(path, limits);
+  std::cout << std::left << std::setw(12) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(10) << path.length() << std::setw(12)
+            << min_radius(path) << std::setw(12) << profile.LapTime() << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " waypoints.csv racing_line.bin [--key value]..."
+              << std::endl;
+    return 1;
+  }
+  // The settings after the two paths, parsed like the controller's
+  std::vector<char*> args(1, argv[0]);
+  args.insert(args.end(), argv + 3, argv + argc);
+  ControllerConfig config;
+  if (!load_config(static_cast<int>(args.size()), args.data(), config)) {
+    return 1;
+  }
+  const RacingLineOptions& options = config.racing_line_options;
+  const SpeedLimits& limits = config.speed_limits;
+
+  TrackPath centre;
+  if (!centre.Load(argv[1])) {
+    return 1;
+  }
+  auto start = std::chrono::steady_clock::now();
+  TrackPath line = optimize_racing_line(centre, options);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (line.empty() || !line.Save(argv[2])) {
+    return 1;
+  }
+
+  std::cout << line.size() << " points, optimised in " << elapsed * 1000 << " ms" << std::endl;
+  std::cout << std::left << std::setw(12) << "path" << std::right << std::setw(10)
+            << "length m" << std::setw(12) << "min radius" << std::setw(12) << "lap s"
+            << std::endl;
+  report("centre", resample_track(centre, options.spacing), limits);
+  report("racing", line, limits);
+  return 0;
+}
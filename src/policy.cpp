@@ -0,0 +1,151 @@
+#include "policy.h"
+#include <cmath>
+#include <iostream>
+
+//
+// PolicyNet class definition implementation.
+//
+PolicyNet::PolicyNet() : loaded_(false) {}
+
+namespace {
+
+// Reads rows * cols values in row-major order into m.
+template <typename Matrix>
+bool read_matrix(istream& in, Matrix& m) {
+  for (int r = 0; r < m.rows(); ++r) {
+    for (int c = 0; c < m.cols(); ++c) {
+      if (!(in >> m(r, c))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool PolicyNet::Load(const string& path) {
+  loaded_ = false;
+  ifstream in(path.c_str());
+  if (!in.is_open()) {
+    cerr << "Unable to open policy weights " << path << endl;
+    return false;
+  }
+
+  string magic;
+  int version, inputs, hidden, outputs;
+  in >> magic >> version >> inputs >> hidden >> outputs;
+  if (!in || magic != "mpc-policy" || version != 1 || inputs != kInputs ||
+      hidden != kHidden || outputs != kOutputs) {
+    cerr << "Unexpected policy weights header in " << path << endl;
+    return false;
+  }
+
+  bool ok = read_matrix(in, mean_) && read_matrix(in, scale_) &&
+            read_matrix(in, w1_) && read_matrix(in, b1_) &&
+            read_matrix(in, w2_) && read_matrix(in, b2_) &&
+            read_matrix(in, w3_) && read_matrix(in, b3_);
+  if (!ok) {
+    cerr << "Truncated policy weights in " << path << endl;
+    return false;
+  }
+
+  // Store the reciprocal so that normalisation is a multiplication
+  for (int i = 0; i < kInputs; ++i) {
+    scale_[i] = scale_[i] != 0.0 ? 1.0 / scale_[i] : 0.0;
+  }
+
+  loaded_ = true;
+  return true;
+}
+
+PolicyNet::Output PolicyNet::Evaluate(const VectorRef& state,
+                                      const VectorRef& coeffs) const {
+  Input in;
+  in << state[0], state[1], state[2], state[3], state[4], state[5],
+        coeffs[0], coeffs[1], coeffs[2], coeffs[3];
+  in = (in - mean_).cwiseProduct(scale_);
+
+  Hidden h1 = (w1_ * in + b1_).array().tanh().matrix();
+  Hidden h2 = (w2_ * h1 + b2_).array().tanh().matrix();
+  return w3_ * h2 + b3_;
+}
+
+//
+// PolicyRecorder class definition implementation.
+//
+PolicyRecorder::PolicyRecorder(const string& path)
+    : out_(path.c_str(), ios::out | ios::app) {
+  out_.precision(10);
+}
+
+void PolicyRecorder::Record(const VectorRef& state, const VectorRef& coeffs, double steer,
+                            double throttle, double cost) {
+  for (int i = 0; i < 6; ++i) {
+    out_ << state[i] << ",";
+  }
+  for (int i = 0; i < 4; ++i) {
+    out_ << coeffs[i] << ",";
+  }
+  out_ << steer << "," << throttle << "," << cost << "\n";
+}
+
+//
+// PolicyController class definition implementation.
+//
+PolicyController::PolicyController(MPC& mpc, const PolicyNet* net,
+                                   PolicyRecorder* recorder)
+    : tolerance(0.25), approximated(0), solved(0), shifted(0), tracked(0),
+      mpc_(mpc), net_(net), recorder_(recorder) {}
+
+void PolicyController::Control(const VectorRef& state, const VectorRef& coeffs,
+                               chrono::steady_clock::time_point deadline, MPCResult& res) {
+  if (net_ != NULL && net_->loaded()) {
+    PolicyNet::Output out = net_->Evaluate(state, coeffs);
+    double steer = out[0];
+    double throttle = out[1];
+    double predicted_cost = out[2];
+
+    // Same actuator limits as the solver
+    const ActuatorLimits& limits = mpc_.limits;
+    bool in_bounds = fabs(steer) <= limits.max_steer &&
+                     throttle >= limits.min_throttle && throttle <= limits.max_throttle;
+    if (in_bounds) {
+      mpc_.Rollout(state, coeffs, steer, throttle, res);
+      double error = fabs(res.cost - predicted_cost) / max(fabs(res.cost), 1.0);
+      if (error <= tolerance) {
+        ++approximated;
+        res.quality = SOLVE_APPROXIMATED;
+        return;
+      }
+    }
+  }
+
+  // Not enough time left for a solve: reuse the previous plan if it is recent
+  double remaining = chrono::duration<double>(deadline - chrono::steady_clock::now()).count();
+  bool late = remaining < mpc_.ExpectedSolveTime();
+  if (late) {
+    mpc_.Shift(state, coeffs, res);
+  }
+  if (!late || res.quality != SOLVE_SHIFTED) {
+    ++solved;
+    mpc_.Solve(state, coeffs, deadline, res);
+    // Only solver outputs are worth imitating, not fallbacks
+    if (recorder_ != NULL && res.quality <= SOLVE_FEASIBLE) {
+      double steer = res.next_steering_angle();
+      double throttle = res.next_throttle();
+      mpc_.Rollout(state, coeffs, steer, throttle, label_);
+      recorder_->Record(state, coeffs, steer, throttle, label_.cost);
+    }
+  }
+
+  if (res.quality == SOLVE_SHIFTED) {
+    ++shifted;
+  } else if (res.quality == SOLVE_FAILED) {
+    ++tracked;
+    double steer, throttle;
+    tracker.Control(state, steer, throttle);
+    mpc_.Rollout(state, coeffs, steer, throttle, res);
+    res.quality = SOLVE_TRACKED;
+  }
+}
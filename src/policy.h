@@ -0,0 +1,132 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include "Eigen-3.3/Eigen/Core"
+#include "MPC.h"
+#include "tracking.h"
+
+using namespace std;
+
+//
+// A small feed-forward approximation of the MPC policy, distilled offline
+// from recorded MPC::Solve outputs.
+//
+// The network maps the 10 values [x, y, psi, v, cte, epsi, c0, c1, c2, c3]
+// (state followed by the polynomial coefficients) through two tanh hidden
+// layers to [steering angle, throttle, predicted cost]. All matrices are
+// fixed-size so inference is a handful of small matrix products.
+//
+class PolicyNet {
+ public:
+  static const int kInputs = 10;
+  static const int kHidden = 16;
+  static const int kOutputs = 3;
+
+  typedef Eigen::Matrix<double, kInputs, 1> Input;
+  typedef Eigen::Matrix<double, kHidden, 1> Hidden;
+  typedef Eigen::Matrix<double, kOutputs, 1> Output;
+
+  PolicyNet();
+
+  // Load weights from a text file with the layout
+  //
+  //   mpc-policy 1 10 16 3
+  //   <input mean, 10 values>
+  //   <input scale, 10 values>
+  //   <W1, 16x10 row-major> <b1, 16>
+  //   <W2, 16x16 row-major> <b2, 16>
+  //   <W3, 3x16 row-major>  <b3, 3>
+  //
+  // Returns false (and leaves the network unloaded) on any mismatch.
+  bool Load(const string& path);
+
+  bool loaded() const { return loaded_; }
+
+  // Evaluates the network. Returns [steering angle, throttle, predicted cost].
+  Output Evaluate(const VectorRef& state, const VectorRef& coeffs) const;
+
+ private:
+  bool loaded_;
+
+  Input mean_;
+  Input scale_;
+
+  Eigen::Matrix<double, kHidden, kInputs> w1_;
+  Hidden b1_;
+  Eigen::Matrix<double, kHidden, kHidden> w2_;
+  Hidden b2_;
+  Eigen::Matrix<double, kOutputs, kHidden> w3_;
+  Output b3_;
+};
+
+//
+// Appends one CSV row per solver call so the network can be trained offline:
+// x,y,psi,v,cte,epsi,c0,c1,c2,c3,steering_angle,throttle,cost
+//
+// The cost is that of MPC::Rollout with the solver's first actuation held,
+// the value the safety monitor compares the network's prediction with, not
+// the optimal cost of the time-varying plan.
+//
+class PolicyRecorder {
+ public:
+  explicit PolicyRecorder(const string& path);
+
+  bool is_open() const { return out_.is_open(); }
+
+  void Record(const VectorRef& state, const VectorRef& coeffs, double steer, double throttle,
+              double cost);
+
+ private:
+  ofstream out_;
+};
+
+//
+// Produces actuations from the approximator when it can be trusted and from
+// the full solver otherwise.
+//
+// The safety monitor rolls the bicycle model out with the network's
+// actuations and prices the trajectory with the solver's own cost. When the
+// network's predicted cost disagrees with that rollout by more than the
+// tolerance (or the actuations leave their bounds) the approximation is
+// considered poor and MPC::Solve is invoked instead. Accepted actuations
+// come with quality SOLVE_APPROXIMATED.
+//
+// Under load the solver is skipped in favour of the shifted previous plan
+// when the deadline leaves less time than a solve usually takes; when that
+// plan is stale a solve is attempted anyway. Whenever no plan comes out of
+// this (the solve failed and the previous plan is stale), the Stanley path
+// tracker drives.
+//
+class PolicyController {
+ public:
+  PolicyController(MPC& mpc, const PolicyNet* net, PolicyRecorder* recorder);
+
+  // Relative disagreement between predicted and rollout cost that is still accepted
+  double tolerance;
+
+  // Last resort when no plan is available
+  StanleyController tracker;
+
+  // Number of ticks served by the approximator and by the solver, and of
+  // those that ended up on the shifted previous plan or on the tracker
+  unsigned long approximated;
+  unsigned long solved;
+  unsigned long shifted;
+  unsigned long tracked;
+
+  // The solver, when needed, returns by the given deadline
+  void Control(const VectorRef& state, const VectorRef& coeffs,
+               chrono::steady_clock::time_point deadline, MPCResult& res);
+
+ private:
+  MPC& mpc_;
+  const PolicyNet* net_;
+  PolicyRecorder* recorder_;
+  // Rollout of the solver's first actuation, priced for the recorder
+  MPCResult label_;
+};
+
+#endif /* POLICY_H */
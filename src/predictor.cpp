@@ -0,0 +1,48 @@
+#include "predictor.h"
+#include <algorithm>
+#include <cmath>
+#include "vehicle_model.h"
+
+namespace {
+
+// Integrates the model over `latency` in RK4 substeps of at most `max_step`
+struct Propagate {
+  double v;
+  double delta;
+  double a;
+  double latency;
+  double max_step;
+  double* s;
+
+  template <typename Model>
+  void operator()(const Model& model) {
+    model.init(v, delta, s);
+    int steps = latency > 0.0 ? int(ceil(latency / max_step)) : 0;
+    double h = steps > 0 ? latency / steps : 0.0;
+    for (int i = 0; i < steps; ++i) {
+      double s1[full_states];
+      std::copy(s, s + full_states, s1);
+      RK4::step(model, s, delta, a, h, s1);
+      std::copy(s1, s1 + full_states, s);
+    }
+  }
+};
+
+}  // namespace
+
+//
+// StatePredictor class definition implementation.
+//
+StatePredictor::StatePredictor() : max_step(0.02) {}
+
+VehicleState StatePredictor::Predict(double v, double delta, double a,
+                                     double latency,
+                                     const Eigen::Ref<const Eigen::VectorXd>& coeffs) const {
+  double s[full_states] = {0.0, 0.0, 0.0, v, 0.0, 0.0, 0.0, 0.0};
+  Propagate propagate = {v, delta, a, latency, max_step, s};
+  dispatch_model(model, propagate);
+
+  path_errors(s[0], s[1], s[2], coeffs, s[4], s[5]);
+
+  return Eigen::Map<const VehicleState>(s);
+}
@@ -0,0 +1,38 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include "Eigen-3.3/Eigen/Core"
+#include "vehicle_model.h"
+
+// [x, y, psi, v, cte, epsi, vy, r], the full state of vehicle_model.h
+typedef Eigen::Matrix<double, 8, 1> VehicleState;
+
+//
+// Compensates for the delay between a telemetry sample and the moment the
+// resulting actuation takes effect.
+//
+// The vehicle is forward-integrated over the delay with the same vehicle
+// model the MPC uses, with classical RK4, holding the actuation that is
+// currently applied. The simulator does not report the dynamic model's
+// lateral velocity and yaw rate; they start from the steady no-slip turn at
+// the current steering angle. The prediction is made in the vehicle frame at the
+// time of the sample (the vehicle at the origin, heading along x), and the
+// errors are evaluated against the fitted path at the predicted pose.
+//
+class StatePredictor {
+ public:
+  StatePredictor();
+
+  // Largest RK4 substep (seconds)
+  double max_step;
+
+  ModelConfig model;
+
+  // Returns the full state `latency` seconds ahead, given the
+  // speed v (m/s), the current steering angle delta (radians, positive turns
+  // right) and acceleration a.
+  VehicleState Predict(double v, double delta, double a, double latency,
+                       const Eigen::Ref<const Eigen::VectorXd>& coeffs) const;
+};
+
+#endif /* PREDICTOR_H */
@@ -0,0 +1,173 @@
+#include "racing_line.h"
+
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/Eigen/Sparse"
+#include "Eigen-3.3/Eigen/SparseCholesky"
+
+using Eigen::SparseMatrix;
+using Eigen::Triplet;
+using Eigen::VectorXd;
+
+TrackPath resample_track(const TrackPath& path, double spacing) {
+  // Points of the spline, finely enough for straight pieces between them
+  const int kPieces = 32;
+  const std::vector<double>& xs = path.xs();
+  const std::vector<double>& ys = path.ys();
+  const size_t n = path.size();
+  std::vector<double> fine_x, fine_y;
+  for (size_t i = 0; i < n; ++i) {
+    size_t p[4] = {(i + n - 1) % n, i, (i + 1) % n, (i + 2) % n};
+    // Knots spaced by the square root of the chord lengths
+    double t[4] = {0.0};
+    for (int k = 1; k < 4; ++k) {
+      double chord = hypot(xs[p[k]] - xs[p[k - 1]], ys[p[k]] - ys[p[k - 1]]);
+      t[k] = t[k - 1] + std::max(sqrt(chord), 1e-6);
+    }
+    for (int piece = 0; piece < kPieces; ++piece) {
+      double u = t[1] + (t[2] - t[1]) * piece / kPieces;
+      double point[2];
+      for (int d = 0; d < 2; ++d) {
+        const std::vector<double>& c = d == 0 ? xs : ys;
+        // Barry and Goldman's pyramidal evaluation
+        double a1 = ((t[1] - u) * c[p[0]] + (u - t[0]) * c[p[1]]) / (t[1] - t[0]);
+        double a2 = ((t[2] - u) * c[p[1]] + (u - t[1]) * c[p[2]]) / (t[2] - t[1]);
+        double a3 = ((t[3] - u) * c[p[2]] + (u - t[2]) * c[p[3]]) / (t[3] - t[2]);
+        double b1 = ((t[2] - u) * a1 + (u - t[0]) * a2) / (t[2] - t[0]);
+        double b2 = ((t[3] - u) * a2 + (u - t[1]) * a3) / (t[3] - t[1]);
+        point[d] = ((t[2] - u) * b1 + (u - t[1]) * b2) / (t[2] - t[1]);
+      }
+      fine_x.push_back(point[0]);
+      fine_y.push_back(point[1]);
+    }
+  }
+  TrackPath fine;
+  fine.Assign(fine_x, fine_y);
+
+  const size_t m = std::max(size_t(3), size_t(round(fine.length() / spacing)));
+  const double h = fine.length() / m;
+  std::vector<double> rx(m), ry(m);
+  for (size_t k = 0; k < m; ++k) {
+    fine.PointAt(k * h, rx[k], ry[k]);
+  }
+  TrackPath resampled;
+  resampled.Assign(rx, ry);
+  return resampled;
+}
+
+TrackPath optimize_racing_line(const TrackPath& centre, const RacingLineOptions& options) {
+  TrackPath resampled = resample_track(centre, options.spacing);
+  const size_t m = resampled.size();
+  const double w = options.half_width;
+
+  // Centre line, and its unit normals (to the left)
+  VectorXd cx = Eigen::Map<const VectorXd>(resampled.xs().data(), m);
+  VectorXd cy = Eigen::Map<const VectorXd>(resampled.ys().data(), m);
+  VectorXd nx(m), ny(m);
+  for (size_t k = 0; k < m; ++k) {
+    size_t prev = (k + m - 1) % m;
+    size_t next = (k + 1) % m;
+    double tx = cx[next] - cx[prev];
+    double ty = cy[next] - cy[prev];
+    double len = hypot(tx, ty);
+    nx[k] = -ty / len;
+    ny[k] = tx / len;
+  }
+
+  // Second differences of the points, c + diag(n) alpha for each coordinate:
+  // D c + D diag(n) alpha with D the cyclic second difference
+  std::vector<Triplet<double> > entries;
+  SparseMatrix<double> D(m, m);
+  for (size_t k = 0; k < m; ++k) {
+    entries.push_back(Triplet<double>(k, (k + m - 1) % m, 1.0));
+    entries.push_back(Triplet<double>(k, k, -2.0));
+    entries.push_back(Triplet<double>(k, (k + 1) % m, 1.0));
+  }
+  D.setFromTriplets(entries.begin(), entries.end());
+  SparseMatrix<double> Ax = D * SparseMatrix<double>(VectorXd(nx).asDiagonal());
+  SparseMatrix<double> Ay = D * SparseMatrix<double>(VectorXd(ny).asDiagonal());
+
+  // Cost 1/2 a'Ha + g'a, with a tiny ridge for the offsets the second
+  // differences cannot see
+  SparseMatrix<double> H = SparseMatrix<double>(Ax.transpose() * Ax) +
+                           SparseMatrix<double>(Ay.transpose() * Ay);
+  for (size_t k = 0; k < m; ++k) {
+    H.coeffRef(k, k) += 1e-9;
+  }
+  VectorXd g = Ax.transpose() * (D * cx) + Ay.transpose() * (D * cy);
+
+  // -1 at the lower bound, 1 at the upper bound and 0 free
+  std::vector<int> bound(m, 0);
+  VectorXd alpha = VectorXd::Zero(m);
+  Eigen::SimplicialLDLT<SparseMatrix<double> > solver;
+  int iteration = 0;
+  for (; iteration < options.max_iterations; ++iteration) {
+    // Fixed offsets become identity rows; the free ones see them in the
+    // right hand side
+    entries.clear();
+    VectorXd rhs(m);
+    for (size_t k = 0; k < m; ++k) {
+      if (bound[k] != 0) {
+        entries.push_back(Triplet<double>(k, k, 1.0));
+        rhs[k] = bound[k] * w;
+        continue;
+      }
+      rhs[k] = -g[k];
+      for (SparseMatrix<double>::InnerIterator it(H, k); it; ++it) {
+        size_t j = it.row();
+        if (bound[j] != 0) {
+          rhs[k] -= it.value() * bound[j] * w;
+        } else {
+          entries.push_back(Triplet<double>(k, j, it.value()));
+        }
+      }
+    }
+    SparseMatrix<double> K(m, m);
+    K.setFromTriplets(entries.begin(), entries.end());
+    solver.compute(K);
+    if (solver.info() == Eigen::Success) {
+      alpha = solver.solve(rhs);
+    }
+    if (solver.info() != Eigen::Success) {
+      std::cerr << "Racing line: factorisation failed" << std::endl;
+      return TrackPath();
+    }
+
+    // Multipliers of the bounds: minus the gradient, which must point out of
+    // the road for an offset to stay at its bound. Scaled by the curvature
+    // of the cost, the multiplier is the step the offset would take alone.
+    VectorXd lambda = -(H * alpha + g);
+    bool changed = false;
+    for (size_t k = 0; k < m; ++k) {
+      double step = alpha[k] + lambda[k] / H.coeff(k, k);
+      int next = 0;
+      if (step > w) {
+        next = 1;
+      } else if (step < -w) {
+        next = -1;
+      }
+      changed = changed || next != bound[k];
+      bound[k] = next;
+    }
+    if (!changed) {
+      break;
+    }
+  }
+  if (iteration == options.max_iterations) {
+    std::cerr << "Racing line: active set did not settle in " << iteration << " iterations"
+              << std::endl;
+  }
+
+  std::vector<double> xs(m), ys(m);
+  for (size_t k = 0; k < m; ++k) {
+    double a = std::min(std::max(alpha[k], -w), w);
+    xs[k] = cx[k] + a * nx[k];
+    ys[k] = cy[k] + a * ny[k];
+  }
+  TrackPath line;
+  line.Assign(xs, ys);
+  return line;
+}
@@ -0,0 +1,43 @@
+#ifndef RACING_LINE_H
+#define RACING_LINE_H
+
+#include "track_path.h"
+
+struct RacingLineOptions {
+  // Distance between the points of the line (m)
+  double spacing;
+  // Furthest the line may move from the centre line to either side (m),
+  // i.e. half the road width less half the car and a margin
+  double half_width;
+  // Active set iterations of the solver
+  int max_iterations;
+
+  RacingLineOptions() : spacing(2.0), half_width(2.5), max_iterations(100) {}
+};
+
+// Smooth closed curve through the points of `path` (a centripetal
+// Catmull-Rom spline, which does not overshoot between unevenly spaced
+// waypoints), resampled every `spacing` metres along it.
+TrackPath resample_track(const TrackPath& path, double spacing);
+
+//
+// Minimum curvature racing line around a closed track.
+//
+// The centre line is resampled (see resample_track) and every point may
+// move along its normal by an offset within +-half_width. The offsets
+// minimise the sum of the squared second differences of the points, i.e.
+// of the curvature times spacing^2, which is a quadratic in the offsets
+// with a banded sparse Hessian. The bounds are handled by a primal-dual
+// active set: each iteration fixes the offsets at their bounds and solves
+// for the others with a sparse Cholesky factorisation, until the set of
+// offsets at a bound stops changing.
+//
+// A lower curvature allows higher cornering speeds for the same lateral
+// acceleration, which is most of the lap time on this track (compare the
+// lap times of the SpeedProfile of both lines).
+//
+// Returns an empty path if the factorisation fails.
+//
+TrackPath optimize_racing_line(const TrackPath& centre, const RacingLineOptions& options);
+
+#endif /* RACING_LINE_H */
@@ -0,0 +1,96 @@
+#include "runtime.h"
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+bool pin_thread(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    std::cerr << "Unable to pin thread to core " << cpu << ": " << strerror(err) << std::endl;
+    return false;
+  }
+  return true;
+#else
+  std::cerr << "Thread pinning is not supported on this platform" << std::endl;
+  return false;
+#endif
+}
+
+bool set_fifo(int priority) {
+  sched_param param;
+  param.sched_priority = priority;
+  int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (err != 0) {
+    std::cerr << "Unable to set SCHED_FIFO priority " << priority << ": " << strerror(err)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Touches every page of the next `bytes` of stack below the caller
+void prefault(size_t bytes) {
+  volatile char* stack = static_cast<volatile char*>(alloca(bytes));
+  for (size_t i = 0; i < bytes; i += 4096) {
+    stack[i] = 0;
+  }
+}
+
+}  // namespace
+
+RuntimeConfig::RuntimeConfig()
+    : control_cpu(-1), fifo_priority(0), lock_memory(false), prefault_stack(0) {}
+
+bool parse_cpu_list(const std::string& list, std::vector<int>& cpus) {
+  std::istringstream in(list);
+  std::string item;
+  cpus.clear();
+  while (std::getline(in, item, ',')) {
+    char* end;
+    long cpu = strtol(item.c_str(), &end, 10);
+    if (item.empty() || *end != '\0' || cpu < 0) {
+      return false;
+    }
+    cpus.push_back(int(cpu));
+  }
+  return !cpus.empty();
+}
+
+bool apply_process_config(const RuntimeConfig& config) {
+  if (config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    std::cerr << "Unable to lock memory: " << strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool apply_thread_config(const RuntimeConfig& config, size_t number) {
+  bool ok = true;
+  int cpu = config.control_cpu;
+  if (number > 0) {
+    cpu = config.worker_cpus.empty()
+        ? -1 : config.worker_cpus[(number - 1) % config.worker_cpus.size()];
+  }
+  if (cpu >= 0) {
+    ok &= pin_thread(cpu);
+  }
+  if (config.fifo_priority > 0) {
+    ok &= set_fifo(config.fifo_priority);
+  }
+  if (config.prefault_stack > 0) {
+    prefault(config.prefault_stack);
+  }
+  return ok;
+}
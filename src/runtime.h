@@ -0,0 +1,39 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//
+// Scheduling and memory settings for the control thread (the event loop,
+// which runs the controller) and the solver worker threads, to keep page
+// faults and migrations out of the control loop.
+//
+struct RuntimeConfig {
+  // Core of the control thread, -1 to leave it unpinned
+  int control_cpu;
+  // Cores of the workers, assigned in turn; empty to leave them unpinned
+  std::vector<int> worker_cpus;
+  // SCHED_FIFO priority of all these threads, 0 keeps the default policy
+  int fifo_priority;
+  // Lock all current and future pages in memory (mlockall)
+  bool lock_memory;
+  // Bytes of stack touched by each thread up front so it does not fault later
+  size_t prefault_stack;
+
+  RuntimeConfig();
+};
+
+// Parses a comma-separated list of cores such as "2,3,4".
+bool parse_cpu_list(const std::string& list, std::vector<int>& cpus);
+
+// Applies the process-wide settings. Returns false if any could not be applied.
+bool apply_process_config(const RuntimeConfig& config);
+
+// Applies the settings of the control thread (number 0) or of worker
+// `number` (from 1) to the calling thread. Returns false if any could not
+// be applied.
+bool apply_thread_config(const RuntimeConfig& config, size_t number);
+
+#endif /* RUNTIME_H */
@@ -0,0 +1,136 @@
+#include "smoothing.h"
+
+#include <math.h>
+#include <algorithm>
+#include "Eigen-3.3/Eigen/Cholesky"
+#include "vehicle_model.h"
+
+namespace {
+
+// Rolls the plan's states out under its actuations from the full state s
+struct PlanRollout {
+  const std::vector<double>& dts;
+  bool error_states;
+  const VectorRef& coeffs;
+  PlanTrajectory& plan;
+  double* s;
+
+  template <typename Dynamics>
+  void operator()(const Dynamics& dynamics) {
+    PlanTrajectory::MutableView states[6] = {plan.x(), plan.y(), plan.psi(),
+                                             plan.v(), plan.cte(), plan.epsi()};
+    PlanTrajectory::MutableView delta = plan.delta();
+    PlanTrajectory::MutableView a = plan.a();
+    for (size_t t = 1; t < plan.steps(); ++t) {
+      double s1[full_states];
+      std::copy(s, s + full_states, s1);
+      dynamics.step(s, delta[t - 1], a[t - 1], dts[t - 1], error_states, coeffs, s1);
+      if (!error_states) {
+        path_errors(s1[0], s1[1], s1[2], coeffs, s1[4], s1[5]);
+      }
+      for (size_t k = 0; k < 6; ++k) {
+        states[k][t] = s1[k];
+      }
+      std::copy(s1, s1 + full_states, s);
+    }
+  }
+};
+
+}  // namespace
+
+Smoother::Smoother() : window_(0), order_(0) {}
+
+void Smoother::Apply(const Smoothing& config, const ActuatorLimits& limits,
+                     const std::vector<double>& dts, const ModelConfig& model,
+                     bool error_states, const VectorRef& state, const VectorRef& coeffs,
+                     PlanTrajectory& plan) {
+  size_t n = plan.length(PlanTrajectory::DELTA);
+  if (config.filter == Smoothing::NONE || n == 0) {
+    return;
+  }
+  PlanTrajectory::MutableView delta = plan.delta();
+  PlanTrajectory::MutableView a = plan.a();
+
+  if (config.filter == Smoothing::MOVING_AVERAGE) {
+    size_t window = std::max(config.window, size_t(1));
+    MovingAverage(window, delta.data(), n);
+    MovingAverage(window, a.data(), n);
+  } else {
+    // A polynomial with as many coefficients as the window fits it exactly
+    size_t window = config.window | 1;
+    if (window > n || config.order + 1 >= window) {
+      return;
+    }
+    if (window != window_ || config.order != order_) {
+      BuildWeights(window, config.order);
+    }
+    SavitzkyGolay(delta.data(), n);
+    SavitzkyGolay(a.data(), n);
+  }
+
+  delta = delta.cwiseMax(-limits.max_steer).cwiseMin(limits.max_steer);
+  a = a.cwiseMax(limits.min_throttle).cwiseMin(limits.max_throttle);
+
+  // Roll the states out again from the initial one under the filtered
+  // actuations. The plan holds the first six entries of the full state; the
+  // dynamic model's vy and r start from `state` and are carried in s.
+  PlanTrajectory::MutableView states[6] = {plan.x(), plan.y(), plan.psi(),
+                                           plan.v(), plan.cte(), plan.epsi()};
+  double s[full_states] = {0.0};
+  for (size_t k = 0; k < full_states; ++k) {
+    if (k < 6) {
+      s[k] = states[k][0];
+    } else if (k < size_t(state.size())) {
+      s[k] = state[k];
+    }
+  }
+  PlanRollout rollout = {dts, error_states, coeffs, plan, s};
+  dispatch_dynamics(model, rollout);
+}
+
+// Replaces every value by the mean of the `window` values starting at it,
+// fewer towards the end.
+void Smoother::MovingAverage(size_t window, double* values, size_t n) {
+  size_t end = std::min(window, n);
+  double sum = 0.0;
+  for (size_t i = 0; i < end; ++i) {
+    sum += values[i];
+  }
+  for (size_t i = 0; i < n; ++i) {
+    double value = values[i];
+    values[i] = sum / (end - i);
+    sum -= value;
+    if (end < n) {
+      sum += values[end++];
+    }
+  }
+}
+
+// Centred windows in the interior; the first and last values are taken from
+// the fit over the first and last window.
+void Smoother::SavitzkyGolay(double* values, size_t n) {
+  const size_t window = window_;
+  const size_t half = window / 2;
+  scratch_.assign(values, values + n);
+  Eigen::Map<const Eigen::VectorXd> in(scratch_.data(), n);
+  for (size_t i = 0; i < n; ++i) {
+    size_t first = std::min(std::max(i, half) - half, n - window);
+    values[i] = weights_.col(i - first).dot(in.segment(first, window));
+  }
+}
+
+void Smoother::BuildWeights(size_t window, size_t order) {
+  window_ = window;
+  order_ = order;
+
+  // Least-squares fit of the polynomial over the window, evaluated back at
+  // every position: A (A^T A)^-1 A^T, which is symmetric
+  Eigen::MatrixXd A(window, order + 1);
+  double half = window / 2;
+  for (size_t j = 0; j < window; ++j) {
+    for (size_t k = 0; k <= order; ++k) {
+      A(j, k) = pow(j - half, k);
+    }
+  }
+  weights_ = A * (A.transpose() * A).ldlt().solve(A.transpose());
+}
@@ -0,0 +1,48 @@
+#ifndef SMOOTHING_H
+#define SMOOTHING_H
+
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "MPC.h"
+#include "trajectory.h"
+
+//
+// Post-solve smoothing stage: filters the planned actuations of a trajectory
+// in place, one contiguous block at a time, then rolls the states out again
+// from the initial state through the vehicle model.
+//
+// The moving average keeps a running sum and the Savitzky-Golay filter is a
+// dot product with precomputed weights per output, so both are linear in the
+// horizon length. Weights and scratch space are built on first use and kept,
+// so that smoothing a horizon seen before does not allocate.
+//
+class Smoother {
+ public:
+  Smoother();
+
+  // `dts` holds the duration of every interval and `state` the initial
+  // state as given to MPC::Solve, whose [vy, r] the dynamic model starts
+  // from. cte and epsi follow the error-state model
+  // when `error_states` is set and are evaluated from the path otherwise, as
+  // in the solver. Filtered actuations are clamped to `limits`. Horizons
+  // shorter than a Savitzky-Golay window are left as is.
+  void Apply(const Smoothing& config, const ActuatorLimits& limits,
+             const std::vector<double>& dts, const ModelConfig& model, bool error_states,
+             const VectorRef& state, const VectorRef& coeffs, PlanTrajectory& plan);
+
+ private:
+  void MovingAverage(size_t window, double* values, size_t n);
+  void SavitzkyGolay(double* values, size_t n);
+  void BuildWeights(size_t window, size_t order);
+
+  // Savitzky-Golay window and degree the weights were built for. Column r
+  // holds the weights that evaluate the fitted polynomial at position r of
+  // the window.
+  size_t window_;
+  size_t order_;
+  Eigen::MatrixXd weights_;
+
+  std::vector<double> scratch_;
+};
+
+#endif /* SMOOTHING_H */
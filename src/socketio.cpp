@@ -0,0 +1,224 @@
+#include "socketio.h"
+
+#include <stdio.h>
+
+namespace {
+
+bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+}  // namespace
+
+StrSpan StrSpan::trim() const {
+  size_t b = 0;
+  size_t e = size_;
+  while (b < e && is_space(data_[b])) {
+    ++b;
+  }
+  while (e > b && is_space(data_[e - 1])) {
+    --e;
+  }
+  return StrSpan(data_ + b, e - b);
+}
+
+bool parse_packet(const StrSpan& frame, Packet& packet) {
+  packet = Packet();
+  packet.socket_type = -1;
+  packet.ack_id = -1;
+
+  if (frame.empty() || frame[0] < '0' || frame[0] > '6') {
+    return false;
+  }
+  packet.engine_type = frame[0] - '0';
+  size_t pos = 1;
+
+  if (packet.engine_type == Packet::MESSAGE) {
+    if (frame.size() < 2 || frame[1] < '0' || frame[1] > '6') {
+      return false;
+    }
+    packet.socket_type = frame[1] - '0';
+    pos = 2;
+
+    // Binary packets carry the attachment count first: 51-...
+    if (packet.socket_type == Packet::BINARY_EVENT ||
+        packet.socket_type == Packet::BINARY_ACK) {
+      size_t dash = frame.find('-', pos);
+      if (dash == StrSpan::npos) {
+        return false;
+      }
+      pos = dash + 1;
+    }
+
+    if (pos < frame.size() && frame[pos] == '/') {
+      size_t comma = frame.find(',', pos);
+      size_t end = comma == StrSpan::npos ? frame.size() : comma;
+      packet.nsp = frame.substr(pos, end - pos);
+      pos = comma == StrSpan::npos ? frame.size() : comma + 1;
+    }
+
+    if (pos < frame.size() && frame[pos] >= '0' && frame[pos] <= '9') {
+      packet.ack_id = 0;
+      while (pos < frame.size() && frame[pos] >= '0' && frame[pos] <= '9') {
+        packet.ack_id = packet.ack_id * 10 + (frame[pos] - '0');
+        ++pos;
+      }
+    }
+  }
+
+  packet.data = frame.substr(pos);
+
+  if (packet.socket_type == Packet::EVENT || packet.socket_type == Packet::BINARY_EVENT) {
+    // Reuse the event splitter on the array part of the frame
+    StrSpan body = packet.data.trim();
+    if (body.size() < 2 || body[0] != '[' || body[body.size() - 1] != ']') {
+      return false;
+    }
+    body = body.substr(1, body.size() - 2);
+    size_t open = body.find('"');
+    size_t close = open == StrSpan::npos ? open : body.find('"', open + 1);
+    if (open == StrSpan::npos || close == StrSpan::npos) {
+      return false;
+    }
+    packet.event = body.substr(open + 1, close - open - 1);
+    size_t comma = body.find(',', close + 1);
+    packet.payload = comma == StrSpan::npos ? StrSpan() : body.substr(comma + 1).trim();
+  }
+  return true;
+}
+
+string make_event(const StrSpan& event, const StrSpan& payload, const StrSpan& nsp) {
+  string msg;
+  msg.reserve(8 + nsp.size() + event.size() + payload.size());
+  msg += "42";
+  if (!nsp.empty()) {
+    msg.append(nsp.data(), nsp.size());
+    msg += ',';
+  }
+  msg += "[\"";
+  msg.append(event.data(), event.size());
+  msg += "\",";
+  msg.append(payload.data(), payload.size());
+  msg += ']';
+  return msg;
+}
+
+string make_ack(long ack_id, const StrSpan& args, const StrSpan& nsp) {
+  char id[24];
+  int n = snprintf(id, sizeof(id), "%ld", ack_id);
+  string msg;
+  msg.reserve(4 + nsp.size() + n + args.size());
+  msg += "43";
+  if (!nsp.empty()) {
+    msg.append(nsp.data(), nsp.size());
+    msg += ',';
+  }
+  msg.append(id, n);
+  msg.append(args.data(), args.size());
+  return msg;
+}
+
+//
+// SocketIO class definition implementation.
+//
+SocketIO::SocketIO() {}
+
+size_t SocketIO::hash(const StrSpan& name) {
+  // FNV-1a
+  size_t h = 2166136261u;
+  for (size_t i = 0; i < name.size(); ++i) {
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  }
+  return h;
+}
+
+void SocketIO::On(const string& event, Handler handler) {
+  size_t h = hash(StrSpan(event.data(), event.size()));
+  for (Slot& slot : handlers_) {
+    if (slot.hash == h && slot.name == event) {
+      slot.handler = handler;
+      return;
+    }
+  }
+  Slot slot;
+  slot.name = event;
+  slot.hash = h;
+  slot.handler = handler;
+  handlers_.push_back(slot);
+  Rebuild();
+}
+
+void SocketIO::Rebuild() {
+  // Keep the table at most half full so probe sequences stay short
+  size_t size = 8;
+  while (size < 2 * handlers_.size()) {
+    size *= 2;
+  }
+  table_.assign(size, 0);
+  for (size_t i = 0; i < handlers_.size(); ++i) {
+    size_t pos = handlers_[i].hash & (size - 1);
+    while (table_[pos] != 0) {
+      pos = (pos + 1) & (size - 1);
+    }
+    table_[pos] = i + 1;
+  }
+}
+
+bool SocketIO::Dispatch(const StrSpan& frame, const Sender& send) const {
+  Packet packet;
+  if (!parse_packet(frame, packet)) {
+    return false;
+  }
+
+  switch (packet.engine_type) {
+    case Packet::PING: {
+      // Answer with a pong carrying the same data (e.g. "2probe" -> "3probe")
+      string pong = "3";
+      pong.append(packet.data.data(), packet.data.size());
+      send(pong.data(), pong.size());
+      return true;
+    }
+    case Packet::MESSAGE:
+      break;
+    default:
+      return true;
+  }
+
+  if (packet.socket_type == Packet::CONNECT) {
+    // The default namespace is implicitly connected; acknowledge others
+    if (!packet.nsp.empty()) {
+      string ack = "40";
+      ack.append(packet.nsp.data(), packet.nsp.size());
+      ack += ',';
+      send(ack.data(), ack.size());
+    }
+    return true;
+  }
+  if (packet.socket_type != Packet::EVENT) {
+    return true;
+  }
+
+  size_t h = hash(packet.event);
+  size_t mask = table_.size() - 1;
+  for (size_t pos = h & mask; !table_.empty() && table_[pos] != 0; pos = (pos + 1) & mask) {
+    const Slot& slot = handlers_[table_[pos] - 1];
+    if (slot.hash == h && packet.event == StrSpan(slot.name.data(), slot.name.size())) {
+      slot.handler(packet, send);
+      Acknowledge(packet, send);
+      return true;
+    }
+  }
+
+  if (unhandled_) {
+    unhandled_(packet, send);
+  }
+  Acknowledge(packet, send);
+  return true;
+}
+
+void SocketIO::Acknowledge(const Packet& packet, const Sender& send) {
+  if (packet.ack_id >= 0) {
+    string ack = make_ack(packet.ack_id, StrSpan("[]"), packet.nsp);
+    send(ack.data(), ack.size());
+  }
+}
@@ -0,0 +1,166 @@
+#ifndef SOCKETIO_H
+#define SOCKETIO_H
+
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//
+// A non-owning view over a range of characters, used to walk the uWS
+// receive buffer without copying it. The viewed buffer is only valid for
+// the duration of the uWS callback.
+//
+class StrSpan {
+ public:
+  static const size_t npos = size_t(-1);
+
+  StrSpan() : data_(NULL), size_(0) {}
+  StrSpan(const char* data, size_t size) : data_(data), size_(size) {}
+  StrSpan(const char* s) : data_(s), size_(strlen(s)) {}
+  StrSpan(const string& s) : data_(s.data()), size_(s.size()) {}
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const char* begin() const { return data_; }
+  const char* end() const { return data_ + size_; }
+  char operator[](size_t i) const { return data_[i]; }
+
+  StrSpan substr(size_t pos, size_t n = npos) const {
+    if (pos > size_) {
+      pos = size_;
+    }
+    return StrSpan(data_ + pos, n < size_ - pos ? n : size_ - pos);
+  }
+
+  bool starts_with(const StrSpan& s) const {
+    return size_ >= s.size_ && memcmp(data_, s.data_, s.size_) == 0;
+  }
+
+  size_t find(char c, size_t pos = 0) const {
+    for (size_t i = pos; i < size_; ++i) {
+      if (data_[i] == c) {
+        return i;
+      }
+    }
+    return npos;
+  }
+
+  size_t rfind(char c) const {
+    for (size_t i = size_; i > 0; --i) {
+      if (data_[i - 1] == c) {
+        return i - 1;
+      }
+    }
+    return npos;
+  }
+
+  // Drops surrounding whitespace
+  StrSpan trim() const;
+
+  string str() const { return string(data_, size_); }
+
+  friend bool operator==(const StrSpan& a, const StrSpan& b) {
+    return a.size_ == b.size_ && memcmp(a.data_, b.data_, a.size_) == 0;
+  }
+  friend bool operator!=(const StrSpan& a, const StrSpan& b) { return !(a == b); }
+
+  friend ostream& operator<<(ostream& out, const StrSpan& s) {
+    return out.write(s.data_, s.size_);
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+//
+// One Engine.IO packet, optionally carrying a Socket.IO packet:
+//
+//   <engine type>[<socket type>][/<namespace>,][<ack id>][<data>]
+//
+// All spans are views into the frame the packet was parsed from.
+//
+struct Packet {
+  enum EngineType { OPEN = 0, CLOSE, PING, PONG, MESSAGE, UPGRADE, NOOP };
+  enum SocketType { CONNECT = 0, DISCONNECT, EVENT, ACK, ERROR, BINARY_EVENT, BINARY_ACK };
+
+  int engine_type;
+  // Only meaningful for MESSAGE packets, -1 otherwise
+  int socket_type;
+  // Empty for the default "/" namespace
+  StrSpan nsp;
+  // -1 when no acknowledgement was requested
+  long ack_id;
+  // Everything after the header: the JSON array for events, the probe for pings
+  StrSpan data;
+  // For EVENT packets, the event name and raw JSON payload
+  StrSpan event;
+  StrSpan payload;
+};
+
+// Parses the Engine.IO / Socket.IO header of a text frame.
+// Returns false if the frame is malformed.
+bool parse_packet(const StrSpan& frame, Packet& packet);
+
+// Builds the frame for emitting `event` with a JSON payload.
+string make_event(const StrSpan& event, const StrSpan& payload,
+                  const StrSpan& nsp = StrSpan());
+
+// Builds the frame acknowledging the event with the given ack id, with the
+// JSON array `args` (empty for no arguments).
+string make_ack(long ack_id, const StrSpan& args = StrSpan("[]"),
+                const StrSpan& nsp = StrSpan());
+
+//
+// Routes Socket.IO frames to handlers registered per event name.
+//
+// Handlers are looked up through an open-addressing table keyed by a hash
+// of the event name that is built when handlers are registered, so the hot
+// path performs one hash and at most a single name comparison per frame.
+// Engine.IO pings and namespace connects are answered by the dispatcher
+// itself, as are events requesting an acknowledgement: once the handler has
+// run they are acknowledged without arguments.
+//
+class SocketIO {
+ public:
+  // Sends a text frame back on the connection the frame arrived on
+  typedef std::function<void(const char*, size_t)> Sender;
+  typedef std::function<void(const Packet&, const Sender&)> Handler;
+
+  SocketIO();
+
+  // Registers (or replaces) the handler for `event`.
+  void On(const string& event, Handler handler);
+
+  // Handler for events without a registered handler.
+  void OnUnhandled(Handler handler) { unhandled_ = handler; }
+
+  // Returns false if the frame could not be parsed.
+  bool Dispatch(const StrSpan& frame, const Sender& send) const;
+
+  static size_t hash(const StrSpan& name);
+
+ private:
+  struct Slot {
+    string name;
+    size_t hash;
+    Handler handler;
+  };
+
+  void Rebuild();
+
+  // Replies to an event that requested an acknowledgement
+  static void Acknowledge(const Packet& packet, const Sender& send);
+
+  vector<Slot> handlers_;
+  // Index into handlers_ (+1, so 0 marks an empty slot); size is a power of two
+  vector<size_t> table_;
+  Handler unhandled_;
+};
+
+#endif /* SOCKETIO_H */
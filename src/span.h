@@ -0,0 +1,35 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <cstddef>
+#include <vector>
+
+//
+// Non-owning, read-only view of a contiguous array. The viewed storage must
+// outlive the span.
+//
+template <typename T>
+class Span {
+ public:
+  typedef T value_type;
+  typedef const T* iterator;
+
+  Span() : data_(NULL), size_(0) {}
+  Span(const T* data, size_t size) : data_(data), size_(size) {}
+  Span(const std::vector<T>& v) : data_(v.data()), size_(v.size()) {}
+
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const T& operator[](size_t i) const { return data_[i]; }
+
+  iterator begin() const { return data_; }
+  iterator end() const { return data_ + size_; }
+
+ private:
+  const T* data_;
+  size_t size_;
+};
+
+#endif /* SPAN_H */
@@ -0,0 +1,72 @@
+#include "speed_profile.h"
+
+#include <math.h>
+#include <algorithm>
+
+//
+// SpeedProfile class definition implementation.
+//
+bool SpeedProfile::Load(const std::string& file, const SpeedLimits& limits) {
+  TrackPath path;
+  if (!path.Load(file)) {
+    return false;
+  }
+  Compute(path, limits);
+  return true;
+}
+
+void SpeedProfile::Compute(const TrackPath& path, const SpeedLimits& limits) {
+  path_ = path;
+  const size_t n = path.size();
+
+  // Length of the segment from every point to the next
+  std::vector<double> ds(n);
+  for (size_t i = 0; i < n; ++i) {
+    ds[i] = path.distance(i + 1) - path.distance(i);
+  }
+
+  // Capped by the lateral acceleration in the corners
+  v_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    double kappa = path.Curvature(i);
+    v_[i] = kappa > 0.0 ? std::min(limits.max_speed, sqrt(limits.lateral_accel / kappa))
+                        : limits.max_speed;
+  }
+
+  size_t start = std::min_element(v_.begin(), v_.end()) - v_.begin();
+  for (size_t k = 1; k < n; ++k) {
+    size_t i = (start + k) % n;
+    size_t prev = (i + n - 1) % n;
+    v_[i] = std::min(v_[i], sqrt(v_[prev] * v_[prev] + 2 * limits.accel * ds[prev]));
+  }
+  for (size_t k = 1; k < n; ++k) {
+    size_t i = (start + n - k) % n;
+    size_t next = (i + 1) % n;
+    v_[i] = std::min(v_[i], sqrt(v_[next] * v_[next] + 2 * limits.decel * ds[i]));
+  }
+}
+
+double SpeedProfile::At(double s) const {
+  double t;
+  size_t i = path_.At(s, t);
+  return v_[i] + t * (v_[(i + 1) % v_.size()] - v_[i]);
+}
+
+void SpeedProfile::Sample(double s, double ds, size_t n, std::vector<double>& speeds) const {
+  speeds.resize(n);
+  for (size_t k = 0; k < n; ++k) {
+    speeds[k] = At(s + k * ds);
+  }
+}
+
+double SpeedProfile::LapTime() const {
+  // Constant acceleration over every segment
+  const size_t n = v_.size();
+  double time = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    double v = v_[i] + v_[(i + 1) % n];
+    double ds = path_.distance(i + 1) - path_.distance(i);
+    time += v > 0.0 ? 2 * ds / v : 0.0;
+  }
+  return time;
+}
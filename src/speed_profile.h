@@ -0,0 +1,62 @@
+#ifndef SPEED_PROFILE_H
+#define SPEED_PROFILE_H
+
+#include <string>
+#include <vector>
+#include "track_path.h"
+
+// Bounds the speed profile respects.
+struct SpeedLimits {
+  // Top speed (m/s)
+  double max_speed;
+  // Lateral acceleration allowed in corners (m/s^2)
+  double lateral_accel;
+  // Longitudinal acceleration and braking (m/s^2)
+  double accel;
+  double decel;
+};
+
+//
+// Fastest speed along a closed path, such as the centre line of
+// lake_track_waypoints.csv or a racing line (see racing_line.h), that keeps
+// the lateral acceleration in every corner and the acceleration between
+// corners within limits.
+//
+// The curvature at every waypoint (from the circle through it and its
+// neighbours) caps the speed there at sqrt(lateral_accel / curvature). A
+// forward pass then limits how fast the speed can rise after every corner
+// and a backward pass how late it can drop before the next one. Both passes
+// start from the slowest waypoint, which neither pass can change, so one
+// lap each is enough on a closed track.
+//
+class SpeedProfile {
+ public:
+  // Reads the path (see TrackPath::Load) and computes the profile along it.
+  bool Load(const std::string& file, const SpeedLimits& limits);
+
+  void Compute(const TrackPath& path, const SpeedLimits& limits);
+
+  bool empty() const { return path_.empty(); }
+
+  const TrackPath& path() const { return path_; }
+
+  // Distance along the track (m) of the point of the track closest to (x, y)
+  double Locate(double x, double y) const { return path_.Locate(x, y); }
+
+  // Profile speed (m/s) at distance s along the track, wrapping around
+  double At(double s) const;
+
+  // Writes `n` speeds sampled every `ds` metres from distance s on, reusing
+  // the storage of `speeds`.
+  void Sample(double s, double ds, size_t n, std::vector<double>& speeds) const;
+
+  // Time (s) to drive a lap at the profile speed
+  double LapTime() const;
+
+ private:
+  TrackPath path_;
+  // Speed at every point of the path
+  std::vector<double> v_;
+};
+
+#endif /* SPEED_PROFILE_H */
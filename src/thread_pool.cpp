@@ -0,0 +1,86 @@
+#include "thread_pool.h"
+#include <atomic>
+
+namespace {
+
+thread_local size_t current_thread_num = 0;
+std::atomic<int> running_batches(0);
+
+}  // namespace
+
+//
+// ThreadPool class definition implementation.
+//
+ThreadPool::ThreadPool(size_t threads, const std::function<void(size_t)>& setup)
+    : setup_(setup), job_(NULL), count_(0), next_(0), pending_(0), batch_(0), stop_(false) {
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(&ThreadPool::Work, this, i + 1);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+size_t ThreadPool::thread_num() {
+  return current_thread_num;
+}
+
+bool ThreadPool::in_parallel() {
+  return running_batches > 0;
+}
+
+void ThreadPool::Run(size_t count, const std::function<void(size_t)>& job) {
+  if (count == 0) {
+    return;
+  }
+  ++running_batches;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = &job;
+    count_ = count;
+    next_ = 0;
+    pending_ = count;
+    ++batch_;
+  }
+  start_.notify_all();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return pending_ == 0; });
+  job_ = NULL;
+  --running_batches;
+}
+
+void ThreadPool::Work(size_t number) {
+  current_thread_num = number;
+  if (setup_) {
+    setup_(number);
+  }
+
+  unsigned long seen = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    start_.wait(lock, [this, seen] { return stop_ || batch_ != seen; });
+    if (stop_) {
+      return;
+    }
+    seen = batch_;
+    while (job_ != NULL && next_ < count_) {
+      const std::function<void(size_t)>& job = *job_;
+      size_t index = next_++;
+      lock.unlock();
+      job(index);
+      lock.lock();
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// A fixed set of worker threads running batches of jobs (fork-join).
+//
+// Workers are numbered from 1 so that the thread that owns the pool, and
+// any other thread, is number 0; CppAD needs such a numbering to keep its
+// per-thread tapes and memory apart.
+//
+class ThreadPool {
+ public:
+  // `setup`, when given, runs first thing on every worker with its number
+  explicit ThreadPool(size_t threads,
+                      const std::function<void(size_t)>& setup = std::function<void(size_t)>());
+  ~ThreadPool();
+
+  size_t size() const { return workers_.size(); }
+
+  // Runs job(0) .. job(count - 1) on the workers and returns once all of
+  // them have finished.
+  void Run(size_t count, const std::function<void(size_t)>& job);
+
+  // 1..size() on the workers of a pool, 0 on any other thread
+  static size_t thread_num();
+  // Whether any pool is running a batch
+  static bool in_parallel();
+
+ private:
+  void Work(size_t number);
+
+  std::function<void(size_t)> setup_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+
+  // Current batch, the next index to hand out and the number not finished yet
+  const std::function<void(size_t)>* job_;
+  size_t count_;
+  size_t next_;
+  size_t pending_;
+  unsigned long batch_;
+  bool stop_;
+};
+
+#endif /* THREAD_POOL_H */
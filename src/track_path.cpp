@@ -0,0 +1,198 @@
+#include "track_path.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const char kMagic[4] = {'T', 'R', 'K', 'P'};
+
+void put_u32(std::ostream& out, uint32_t value) {
+  unsigned char bytes[4];
+  for (int i = 0; i < 4; ++i) {
+    bytes[i] = (value >> (8 * i)) & 0xff;
+  }
+  out.write((const char*)bytes, 4);
+}
+
+bool get_u32(std::istream& in, uint32_t& value) {
+  unsigned char bytes[4];
+  if (!in.read((char*)bytes, 4)) {
+    return false;
+  }
+  value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= uint32_t(bytes[i]) << (8 * i);
+  }
+  return true;
+}
+
+void put_float(std::ostream& out, double value) {
+  float f = float(value);
+  uint32_t bits;
+  memcpy(&bits, &f, 4);
+  put_u32(out, bits);
+}
+
+bool get_float(std::istream& in, double& value) {
+  uint32_t bits;
+  if (!get_u32(in, bits)) {
+    return false;
+  }
+  float f;
+  memcpy(&f, &bits, 4);
+  value = f;
+  return true;
+}
+
+}  // namespace
+
+//
+// TrackPath class definition implementation.
+//
+bool TrackPath::Load(const std::string& file) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) {
+    std::cerr << "Unable to open " << file << std::endl;
+    return false;
+  }
+  char magic[4] = {0};
+  in.read(magic, 4);
+  bool binary = in && memcmp(magic, kMagic, 4) == 0;
+  if (!binary) {
+    in.clear();
+    in.seekg(0);
+  }
+  if (!(binary ? LoadBinary(in, file) : LoadCsv(in, file))) {
+    return false;
+  }
+  if (size() < 3) {
+    std::cerr << "Too few points in " << file << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TrackPath::LoadBinary(std::istream& in, const std::string& file) {
+  uint32_t n;
+  std::vector<double> xs, ys;
+  bool ok = get_u32(in, n);
+  for (uint32_t i = 0; ok && i < n; ++i) {
+    double x, y;
+    ok = get_float(in, x) && get_float(in, y);
+    xs.push_back(x);
+    ys.push_back(y);
+  }
+  if (!ok) {
+    std::cerr << "Truncated path file " << file << std::endl;
+    return false;
+  }
+  Assign(xs, ys);
+  return true;
+}
+
+bool TrackPath::LoadCsv(std::istream& in, const std::string& file) {
+  std::vector<double> xs, ys;
+  std::string line;
+  std::getline(in, line);
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    double x, y;
+    char comma;
+    if (!(fields >> x >> comma >> y) || comma != ',') {
+      std::cerr << "Invalid waypoint in " << file << ": " << line << std::endl;
+      return false;
+    }
+    xs.push_back(x);
+    ys.push_back(y);
+  }
+  Assign(xs, ys);
+  return true;
+}
+
+bool TrackPath::Save(const std::string& file) const {
+  std::ofstream out(file, std::ios::binary);
+  out.write(kMagic, 4);
+  put_u32(out, uint32_t(size()));
+  for (size_t i = 0; i < size(); ++i) {
+    put_float(out, xs_[i]);
+    put_float(out, ys_[i]);
+  }
+  if (!out) {
+    std::cerr << "Unable to write " << file << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void TrackPath::Assign(const std::vector<double>& xs, const std::vector<double>& ys) {
+  const size_t n = xs.size();
+  xs_ = xs;
+  ys_ = ys;
+  s_.assign(1, 0.0);
+  for (size_t i = 0; i < n; ++i) {
+    size_t j = (i + 1) % n;
+    s_.push_back(s_.back() + hypot(xs[j] - xs[i], ys[j] - ys[i]));
+  }
+}
+
+double TrackPath::Locate(double x, double y) const {
+  const size_t n = size();
+  double best = INFINITY;
+  double s = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    size_t j = (i + 1) % n;
+    double dx = xs_[j] - xs_[i];
+    double dy = ys_[j] - ys_[i];
+    double len2 = dx * dx + dy * dy;
+    double t = len2 > 0.0 ? ((x - xs_[i]) * dx + (y - ys_[i]) * dy) / len2 : 0.0;
+    t = std::min(std::max(t, 0.0), 1.0);
+    double ex = xs_[i] + t * dx - x;
+    double ey = ys_[i] + t * dy - y;
+    double d2 = ex * ex + ey * ey;
+    if (d2 < best) {
+      best = d2;
+      s = s_[i] + t * (s_[i + 1] - s_[i]);
+    }
+  }
+  return s;
+}
+
+size_t TrackPath::At(double s, double& t) const {
+  const size_t n = size();
+  double L = length();
+  s = fmod(s, L);
+  if (s < 0.0) {
+    s += L;
+  }
+  size_t i = std::upper_bound(s_.begin(), s_.end(), s) - s_.begin();
+  i = std::min(std::max(i, size_t(1)), n) - 1;
+  double len = s_[i + 1] - s_[i];
+  t = len > 0.0 ? (s - s_[i]) / len : 0.0;
+  return i;
+}
+
+void TrackPath::PointAt(double s, double& x, double& y) const {
+  double t;
+  size_t i = At(s, t);
+  size_t j = (i + 1) % size();
+  x = xs_[i] + t * (xs_[j] - xs_[i]);
+  y = ys_[i] + t * (ys_[j] - ys_[i]);
+}
+
+double TrackPath::Curvature(size_t i) const {
+  const size_t n = size();
+  size_t prev = (i + n - 1) % n;
+  size_t next = (i + 1) % n;
+  double ax = xs_[i] - xs_[prev], ay = ys_[i] - ys_[prev];
+  double bx = xs_[next] - xs_[i], by = ys_[next] - ys_[i];
+  // 2 |cross| / (product of the sides)
+  double chord = hypot(xs_[next] - xs_[prev], ys_[next] - ys_[prev]);
+  double sides = (s_[i] - s_[prev]) * (s_[i + 1] - s_[i]) * chord;
+  return sides > 0.0 ? 2 * fabs(ax * by - ay * bx) / sides : 0.0;
+}
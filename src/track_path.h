@@ -0,0 +1,59 @@
+#ifndef TRACK_PATH_H
+#define TRACK_PATH_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+//
+// Closed path around the track in driving order, such as the centre line
+// waypoints of lake_track_waypoints.csv or a racing line. The last point
+// connects back to the first.
+//
+class TrackPath {
+ public:
+  // Reads a binary path file (see Save) or a CSV file with an `x,y` header.
+  // Returns false on a read error or fewer than three points.
+  bool Load(const std::string& file);
+
+  // Writes the binary path file: the magic "TRKP", the number of points as
+  // a uint32 and then x and y of every point as float32, little endian.
+  bool Save(const std::string& file) const;
+
+  void Assign(const std::vector<double>& xs, const std::vector<double>& ys);
+
+  bool empty() const { return xs_.empty(); }
+  size_t size() const { return xs_.size(); }
+  const std::vector<double>& xs() const { return xs_; }
+  const std::vector<double>& ys() const { return ys_; }
+
+  // Distance along the path (m) of point i, up to size() for the end of
+  // the lap
+  double distance(size_t i) const { return s_[i]; }
+
+  // Lap length (m)
+  double length() const { return empty() ? 0.0 : s_.back(); }
+
+  // Distance along the path (m) of the point of the path closest to (x, y)
+  double Locate(double x, double y) const;
+
+  // Point at distance s along the path, wrapping around. Returns the index
+  // of the segment it lies on and the fraction of the segment in t.
+  size_t At(double s, double& t) const;
+  void PointAt(double s, double& x, double& y) const;
+
+  // Curvature (1/m) at point i, from the circle through it and its
+  // neighbours; 0 on a straight
+  double Curvature(size_t i) const;
+
+ private:
+  bool LoadBinary(std::istream& in, const std::string& file);
+  bool LoadCsv(std::istream& in, const std::string& file);
+
+  std::vector<double> xs_;
+  std::vector<double> ys_;
+  // size() + 1 entries, the last closing the loop
+  std::vector<double> s_;
+};
+
+#endif /* TRACK_PATH_H */
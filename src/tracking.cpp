@@ -0,0 +1,28 @@
+#include "tracking.h"
+#include <algorithm>
+#include <cmath>
+
+//
+// StanleyController class definition implementation.
+//
+StanleyController::StanleyController()
+    : gain(0.5), softening(1.0), speed_gain(0.1), target_speed(70 * 0.44704) {
+  limits.max_steer = 0.436332;
+  limits.min_throttle = -1;
+  limits.max_throttle = 0.75;
+}
+
+void StanleyController::Control(const Eigen::Ref<const Eigen::VectorXd>& state,
+                                double& steer, double& throttle) const {
+  double v = state[3];
+  double cte = state[4];
+  double epsi = state[5];
+
+  // A positive steering angle turns right, and a positive cte means the path
+  // lies to the left
+  steer = epsi - atan(gain * cte / (softening + std::max(v, 0.0)));
+  steer = std::min(std::max(steer, -limits.max_steer), limits.max_steer);
+
+  throttle = speed_gain * (target_speed - v);
+  throttle = std::min(std::max(throttle, limits.min_throttle), limits.max_throttle);
+}
@@ -0,0 +1,36 @@
+#ifndef TRACKING_H
+#define TRACKING_H
+
+#include "Eigen-3.3/Eigen/Core"
+#include "MPC.h"
+
+//
+// Closed-form Stanley path tracker, the last resort when neither a solve nor
+// a recent plan is available.
+//
+// Works on the same state as the MPC, [x, y, psi, v, cte, epsi] in the car's
+// coordinate system, and costs a few arithmetic operations. Steering cancels
+// the heading error and steers towards the path in proportion to the cross
+// track error, softened at low speed; throttle is a proportional speed
+// controller.
+//
+class StanleyController {
+ public:
+  StanleyController();
+
+  // Cross track error gain (1/s) and low-speed softening (m/s)
+  double gain;
+  double softening;
+  // Throttle per m/s of speed error, and the speed to hold (m/s)
+  double speed_gain;
+  double target_speed;
+
+  // Bounds of the actuations, normally the solver's
+  ActuatorLimits limits;
+
+  // Writes steering angle (radians) and throttle within the limits.
+  void Control(const Eigen::Ref<const Eigen::VectorXd>& state, double& steer,
+               double& throttle) const;
+};
+
+#endif /* TRACKING_H */
@@ -0,0 +1,43 @@
+#include "trajectory.h"
+
+#include <algorithm>
+
+namespace {
+
+size_t buffer_size(size_t N) {
+  return N == 0 ? 0 : PlanTrajectory::n_states * N + PlanTrajectory::n_actuators * (N - 1);
+}
+
+}  // namespace
+
+void PlanTrajectory::Resize(size_t N) {
+  N_ = N;
+  data_.resize(buffer_size(N));
+}
+
+void PlanTrajectory::Reserve(size_t N) {
+  data_.reserve(buffer_size(N));
+}
+
+void PlanTrajectory::Assign(size_t N, const double* data) {
+  Resize(N);
+  std::copy(data, data + data_.size(), data_.begin());
+}
+
+void PlanTrajectory::Shift(size_t shift) {
+  if (shift == 0) {
+    return;
+  }
+  for (int q = X; q <= A; ++q) {
+    MutableView values = get(Quantity(q));
+    size_t n = values.size();
+    if (n == 0) {
+      continue;
+    }
+    size_t kept = shift < n ? n - shift : 0;
+    double* first = values.data();
+    double last = first[n - 1];
+    std::copy(first + n - kept, first + n, first);
+    std::fill(first + kept, first + n, last);
+  }
+}
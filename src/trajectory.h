@@ -0,0 +1,86 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstddef>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+
+//
+// Predicted states and actuations over a horizon of N timesteps, stored as
+// one contiguous buffer with a block per quantity, in the order the solver
+// lays out its variables:
+//
+//   x y psi v cte epsi (N values each) | delta a (N - 1 values each)
+//
+// which is exactly the solution vector of the simultaneous transcription
+// with error states and no move blocking. The accessors are Eigen views
+// into the buffer, so reading a trajectory never copies it.
+//
+class PlanTrajectory {
+ public:
+  typedef Eigen::Map<const Eigen::VectorXd> View;
+  typedef Eigen::Map<Eigen::VectorXd> MutableView;
+
+  enum Quantity { X, Y, PSI, V, CTE, EPSI, DELTA, A };
+  static const size_t n_states = 6;
+  static const size_t n_actuators = 2;
+
+  PlanTrajectory() : N_(0) {}
+
+  // Timesteps covered, 0 when empty
+  size_t steps() const { return N_; }
+  bool empty() const { return N_ == 0; }
+
+  // Values per quantity: N for the states, one per interval for the actuators
+  size_t length(Quantity q) const {
+    return q < DELTA ? N_ : (N_ > 0 ? N_ - 1 : 0);
+  }
+
+  // Sizes the buffer for N timesteps, leaving the values unspecified. Only
+  // allocates when N exceeds every size used before.
+  void Resize(size_t N);
+  void Reserve(size_t N);
+  void Clear() { Resize(0); }
+
+  // Copies a buffer in the layout above
+  void Assign(size_t N, const double* data);
+
+  // Drops the first `shift` intervals in place: every quantity moves towards
+  // the start and the freed tail repeats its last value.
+  void Shift(size_t shift);
+
+  View get(Quantity q) const { return View(data_.data() + offset(q), length(q)); }
+  MutableView get(Quantity q) { return MutableView(data_.data() + offset(q), length(q)); }
+
+  View x() const { return get(X); }
+  View y() const { return get(Y); }
+  View psi() const { return get(PSI); }
+  View v() const { return get(V); }
+  View cte() const { return get(CTE); }
+  View epsi() const { return get(EPSI); }
+  View delta() const { return get(DELTA); }
+  View a() const { return get(A); }
+
+  MutableView x() { return get(X); }
+  MutableView y() { return get(Y); }
+  MutableView psi() { return get(PSI); }
+  MutableView v() { return get(V); }
+  MutableView cte() { return get(CTE); }
+  MutableView epsi() { return get(EPSI); }
+  MutableView delta() { return get(DELTA); }
+  MutableView a() { return get(A); }
+
+  // The whole buffer
+  const double* data() const { return data_.data(); }
+  size_t size() const { return data_.size(); }
+
+ private:
+  size_t offset(Quantity q) const {
+    return q < DELTA ? q * N_ : n_states * N_ + (q - DELTA) * length(DELTA);
+  }
+
+  size_t N_;
+  std::vector<double> data_;
+};
+
+#endif /* TRAJECTORY_H */
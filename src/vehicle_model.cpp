@@ -0,0 +1,137 @@
+#include "vehicle_model.h"
+
+#include <math.h>
+
+namespace {
+
+// Lateral force of a tire at slip angle alpha and its slope dF/dalpha
+void tire_force(const DynamicModel& p, double stiffness, double load, double alpha,
+                double& force, double& slope) {
+  if (p.tire == DynamicModel::LINEAR) {
+    force = stiffness * alpha;
+    slope = stiffness;
+    return;
+  }
+  double d = p.mu * load;
+  double ba = p.b * alpha;
+  double angle = p.c * atan(ba);
+  force = d * sin(angle);
+  slope = d * cos(angle) * p.c * p.b / (1 + ba * ba);
+}
+
+struct StateCount {
+  size_t n;
+  template <typename Model>
+  void operator()(const Model&) { n = Model::kStates; }
+};
+
+struct StateId {
+  size_t j;
+  size_t k;
+  template <typename Model>
+  void operator()(const Model&) { k = Model::state(j); }
+};
+
+struct Jacobian {
+  const double* s;
+  double delta;
+  double a;
+  Eigen::MatrixXd& A;
+  Eigen::MatrixXd& B;
+  template <typename Model>
+  void operator()(const Model& model) { model.jacobian(s, delta, a, A, B); }
+};
+
+}  // namespace
+
+void KinematicModel::jacobian(const double* s, double delta, double a, Eigen::MatrixXd& A,
+                              Eigen::MatrixXd& B) const {
+  double psi = s[2];
+  double v = s[3];
+  A.setZero(4, 4);
+  B.setZero(4, 2);
+  A(0, 2) = -v * sin(psi);
+  A(0, 3) = cos(psi);
+  A(1, 2) = v * cos(psi);
+  A(1, 3) = sin(psi);
+  A(2, 3) = -delta / lf;
+  B(2, 0) = -v / lf;
+  B(3, 1) = 1.0;
+}
+
+void DynamicModel::jacobian(const double* s, double delta, double a, Eigen::MatrixXd& A,
+                            Eigen::MatrixXd& B) const {
+  const DynamicModel& p = *this;
+  const double g = 9.81;
+  double psi = s[2];
+  double vx = s[3];
+  double vy = s[6];
+  double r = s[7];
+  double steer = -delta;
+  double u = sqrt(vx * vx + 0.25);
+  double du = vx / u;
+
+  // Slip angles and their gradients in [vx, vy, r]
+  double qf = (vy + p.lf * r) / u;
+  double qr = (vy - p.lr * r) / u;
+  double alpha_f = steer - atan(qf);
+  double alpha_r = -atan(qr);
+  double gf = 1 / (1 + qf * qf);
+  double gr = 1 / (1 + qr * qr);
+  double dalpha_f[3] = {qf / u * du * gf, -gf / u, -p.lf * gf / u};
+  double dalpha_r[3] = {qr / u * du * gr, -gr / u, p.lr * gr / u};
+
+  double f_f, k_f, f_r, k_r;
+  tire_force(p, p.cf, p.mass * g * p.lr / (p.lf + p.lr), alpha_f, f_f, k_f);
+  tire_force(p, p.cr, p.mass * g * p.lf / (p.lf + p.lr), alpha_r, f_r, k_r);
+  double cs = cos(steer);
+  double sn = sin(steer);
+
+  A.setZero(6, 6);
+  B.setZero(6, 2);
+  // Position and heading; indices are x, y, psi, vx, vy, r
+  A(0, 2) = -vx * sin(psi) - vy * cos(psi);
+  A(0, 3) = cos(psi);
+  A(0, 4) = -sin(psi);
+  A(1, 2) = vx * cos(psi) - vy * sin(psi);
+  A(1, 3) = sin(psi);
+  A(1, 4) = cos(psi);
+  A(2, 5) = 1.0;
+
+  // Velocities through the tire forces
+  for (int j = 0; j < 3; ++j) {
+    double df_f = k_f * dalpha_f[j];
+    double df_r = k_r * dalpha_r[j];
+    A(3, 3 + j) = -sn * df_f / p.mass;
+    A(4, 3 + j) = (cs * df_f + df_r) / p.mass;
+    A(5, 3 + j) = (p.lf * cs * df_f - p.lr * df_r) / p.iz;
+  }
+  A(3, 4) += r;
+  A(3, 5) += vy;
+  A(4, 3) -= r;
+  A(4, 5) -= vx;
+
+  // d steer / d delta = -1 and d alpha_f / d steer = 1
+  B(3, 0) = (k_f * sn + f_f * cs) / p.mass;
+  B(3, 1) = 1.0;
+  B(4, 0) = (-k_f * cs + f_f * sn) / p.mass;
+  B(5, 0) = p.lf * (-k_f * cs + f_f * sn) / p.iz;
+}
+
+size_t model_state_count(const ModelConfig& config) {
+  StateCount count;
+  dispatch_model(config, count);
+  return count.n;
+}
+
+size_t model_state(const ModelConfig& config, size_t j) {
+  StateId id = {j, 0};
+  dispatch_model(config, id);
+  return id.k;
+}
+
+void model_jacobian(const ModelConfig& config, const double* s, double delta, double a,
+                    Eigen::MatrixXd& A, Eigen::MatrixXd& B) {
+  Jacobian jacobian = {s, delta, a, A, B};
+  dispatch_model(config, jacobian);
+}
@@ -0,0 +1,347 @@
+#ifndef VEHICLE_MODEL_H
+#define VEHICLE_MODEL_H
+
+#include <cmath>
+#include <cstddef>
+#include "Eigen-3.3/Eigen/Core"
+
+//
+// The vehicle models shared by the MPC transcription, the smoother and the
+// latency predictor. All functions are templated on the scalar type so they
+// can be recorded by CppAD (AD<double>) as well as evaluated in double
+// precision.
+//
+// Every model works on the full state [x, y, psi, v, cte, epsi, vy, r]: the
+// pose and the speed along the heading, then the path errors, then the
+// states only the dynamic model has.
+//
+// A model type M satisfies the VehicleModel concept:
+//
+//   M::kStates            number of full state entries it propagates
+//   M::kInputs            number of actuators, [delta, a]
+//   M::state(j)           full state entry of its j-th state
+//   m.deriv(s, delta, a, ds)
+//                         continuous-time derivative of the full state s,
+//                         written to the entries of ds it propagates
+//   m.jacobian(s, delta, a, A, B)
+//                         analytic Jacobians of deriv with respect to its
+//                         states (in state(j) order) and [delta, a]
+//   m.init(v, delta, s)   fills the states the simulator does not report
+//
+// An integrator I discretises any model with I::step(m, s0, delta, a, dt,
+// s1), and Discretized<M, I> is what the transcription runs. Both are
+// template parameters rather than virtual calls, so every combination is
+// compiled into its own specialised transcription. ModelConfig selects one
+// at runtime and dispatch_dynamics() makes that choice once per call.
+//
+
+// This value assumes the model presented in the classroom is used.
+//
+// It was obtained by measuring the radius formed by running the vehicle in the
+// simulator around in a circle with a constant steering angle and velocity on a
+// flat terrain.
+//
+// Lf was tuned until the the radius formed by the simulating the model
+// presented in the classroom matched the previous radius.
+//
+// This is the length from front to CoG that has a similar radius. It is the
+// default of KinematicModel::lf, which is configurable at runtime.
+const double Lf = 2.67;
+
+// Size of the full state
+const size_t full_states = 8;
+
+// Kinematic bicycle model over s = [x, y, psi, v].
+struct KinematicModel {
+  static const size_t kStates = 4;
+  static const size_t kInputs = 2;
+  static size_t state(size_t j) { return j; }
+
+  // Distance from the front axle to the centre of gravity (m)
+  double lf;
+
+  KinematicModel() : lf(Lf) {}
+
+  template <typename Scalar>
+  void deriv(const Scalar* s, Scalar delta, Scalar a, Scalar* ds) const {
+    using std::cos; using std::sin;
+    ds[0] = s[3] * cos(s[2]);
+    ds[1] = s[3] * sin(s[2]);
+    // A positive steering angle turns right, i.e. decreases psi
+    ds[2] = -(s[3] / lf) * delta;
+    ds[3] = a;
+  }
+
+  void jacobian(const double* s, double delta, double a, Eigen::MatrixXd& A,
+                Eigen::MatrixXd& B) const;
+
+  void init(double v, double delta, double* s) const {}
+};
+
+// Dynamic bicycle model over s = [x, y, psi, vx, -, -, vy, r]. vx and vy are
+// the velocity along and across the heading and r the yaw rate, all at the
+// centre of gravity. The tires slip and their lateral forces turn the car, so
+// it understeers and saturates where the kinematic model would follow the
+// steering exactly.
+//
+// The defaults describe a mid-size car whose axles are Lf apart, so that at
+// low speed it turns like the kinematic model.
+struct DynamicModel {
+  static const size_t kStates = 6;
+  static const size_t kInputs = 2;
+  static size_t state(size_t j) { return j < 4 ? j : j + 2; }
+
+  // Lateral force of a tire against its slip angle: linear, F = C alpha, or
+  // Pacejka's magic formula, F = mu Fz sin(c atan(b alpha)), which saturates
+  enum Tire { LINEAR, PACEJKA };
+  Tire tire;
+  // Mass (kg) and yaw moment of inertia (kg m^2)
+  double mass;
+  double iz;
+  // Distances from the centre of gravity to the front and rear axle (m)
+  double lf;
+  double lr;
+  // Cornering stiffness of the front and rear axle (N/rad)
+  double cf;
+  double cr;
+  // Magic formula stiffness and shape factors, and the friction coefficient
+  double b;
+  double c;
+  double mu;
+
+  DynamicModel()
+      : tire(LINEAR), mass(1500.0), iz(2250.0), lf(1.2), lr(Lf - 1.2), cf(80000.0),
+        cr(80000.0), b(10.0), c(1.9), mu(1.0) {}
+
+  template <typename Scalar>
+  void deriv(const Scalar* s, Scalar delta, Scalar a, Scalar* ds) const {
+    using std::atan; using std::cos; using std::sin; using std::sqrt;
+    const Scalar& psi = s[2];
+    const Scalar& vx = s[3];
+    const Scalar& vy = s[6];
+    const Scalar& r = s[7];
+    // Steering angle with the usual sign, positive to the left
+    Scalar steer = -delta;
+    // Keeps the slip angles finite when standing still
+    Scalar u = sqrt(vx * vx + 0.25);
+
+    Scalar alpha_f = steer - atan((vy + lf * r) / u);
+    Scalar alpha_r = -atan((vy - lr * r) / u);
+    Scalar f_f, f_r;
+    if (tire == LINEAR) {
+      f_f = cf * alpha_f;
+      f_r = cr * alpha_r;
+    } else {
+      f_f = load(lr) * mu * sin(c * atan(b * alpha_f));
+      f_r = load(lf) * mu * sin(c * atan(b * alpha_r));
+    }
+
+    ds[0] = vx * cos(psi) - vy * sin(psi);
+    ds[1] = vx * sin(psi) + vy * cos(psi);
+    ds[2] = r;
+    ds[3] = a - f_f * sin(steer) / mass + vy * r;
+    ds[6] = (f_f * cos(steer) + f_r) / mass - vx * r;
+    ds[7] = (lf * f_f * cos(steer) - lr * f_r) / iz;
+  }
+
+  void jacobian(const double* s, double delta, double a, Eigen::MatrixXd& A,
+                Eigen::MatrixXd& B) const;
+
+  // The steady no-slip turn at the given speed and steering angle
+  void init(double v, double delta, double* s) const {
+    s[7] = -v * delta / (lf + lr);
+    s[6] = lr * s[7];
+  }
+
+  // Static load (N) of the axle opposite the given distance from the centre
+  // of gravity
+  double load(double other) const { return mass * 9.81 * other / (lf + lr); }
+};
+
+// Explicit Euler: one evaluation of the dynamics per step.
+struct Euler {
+  template <typename Model, typename Scalar>
+  static void step(const Model& m, const Scalar* s0, Scalar delta, Scalar a, double dt,
+                   Scalar* s1) {
+    Scalar k1[full_states];
+    m.deriv(s0, delta, a, k1);
+    for (size_t j = 0; j < Model::kStates; ++j) {
+      size_t k = Model::state(j);
+      s1[k] = s0[k] + dt * k1[k];
+    }
+  }
+};
+
+// Heun's method (explicit trapezoidal rule): two evaluations per step.
+struct Heun {
+  template <typename Model, typename Scalar>
+  static void step(const Model& m, const Scalar* s0, Scalar delta, Scalar a, double dt,
+                   Scalar* s1) {
+    Scalar k1[full_states], k2[full_states], tmp[full_states];
+    m.deriv(s0, delta, a, k1);
+    for (size_t j = 0; j < Model::kStates; ++j) {
+      size_t k = Model::state(j);
+      tmp[k] = s0[k] + dt * k1[k];
+    }
+    m.deriv(tmp, delta, a, k2);
+    for (size_t j = 0; j < Model::kStates; ++j) {
+      size_t k = Model::state(j);
+      s1[k] = s0[k] + 0.5 * dt * (k1[k] + k2[k]);
+    }
+  }
+};
+
+// Classical fourth-order Runge-Kutta: four evaluations per step.
+struct RK4 {
+  template <typename Model, typename Scalar>
+  static void step(const Model& m, const Scalar* s0, Scalar delta, Scalar a, double dt,
+                   Scalar* s1) {
+    Scalar k1[full_states], k2[full_states], k3[full_states], k4[full_states];
+    Scalar tmp[full_states];
+    m.deriv(s0, delta, a, k1);
+    for (size_t j = 0; j < Model::kStates; ++j) {
+      size_t k = Model::state(j);
+      tmp[k] = s0[k] + 0.5 * dt * k1[k];
+    }
+    m.deriv(tmp, delta, a, k2);
+    for (size_t j = 0; j < Model::kStates; ++j) {
+      size_t k = Model::state(j);
+      tmp[k] = s0[k] + 0.5 * dt * k2[k];
+    }
+    m.deriv(tmp, delta, a, k3);
+    for (size_t j = 0; j < Model::kStates; ++j) {
+      size_t k = Model::state(j);
+      tmp[k] = s0[k] + dt * k3[k];
+    }
+    m.deriv(tmp, delta, a, k4);
+    for (size_t j = 0; j < Model::kStates; ++j) {
+      size_t k = Model::state(j);
+      s1[k] = s0[k] + dt / 6.0 * (k1[k] + 2 * k2[k] + 2 * k3[k] + k4[k]);
+    }
+  }
+};
+
+// Propagates the error states of s0 over one timestep dt given the change of
+// psi over it, writing cte and epsi into s1[4] and s1[5].
+template <typename Scalar>
+void error_step(const Scalar* s0, Scalar dpsi, double dt,
+                const Eigen::Ref<const Eigen::VectorXd>& coeffs, Scalar* s1) {
+  using std::sin; using std::atan;
+  const Scalar& x0 = s0[0];
+  const Scalar& y0 = s0[1];
+  const Scalar& psi0 = s0[2];
+  const Scalar& v0 = s0[3];
+  const Scalar& epsi0 = s0[5];
+
+  Scalar fx = coeffs[0] + coeffs[1] * x0 + coeffs[2] * (x0 * x0) + coeffs[3] * (x0 * x0 * x0);
+
+  Scalar fprime_x = coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * (x0 * x0);
+
+  Scalar desired_psi = atan(fprime_x);
+
+  s1[4] = fx - y0 + v0 * sin(epsi0) * dt;
+  s1[5] = psi0 - desired_psi - dpsi;
+}
+
+// A model discretised by an integrator: the dynamics the transcription rolls
+// out, one timestep at a time.
+template <typename Model, typename Integrator>
+struct Discretized {
+  static const size_t kStates = Model::kStates;
+  static size_t state(size_t j) { return Model::state(j); }
+
+  Model model;
+
+  explicit Discretized(const Model& model) : model(model) {}
+
+  // Advances the full state s0 by one timestep dt, writing the result into
+  // s1. With `error_states` cte and epsi are propagated as well; otherwise
+  // s1[4] and s1[5] are left alone.
+  template <typename Scalar>
+  void step(const Scalar* s0, Scalar delta, Scalar a, double dt, bool error_states,
+            const Eigen::Ref<const Eigen::VectorXd>& coeffs, Scalar* s1) const {
+    Integrator::step(model, s0, delta, a, dt, s1);
+    if (error_states) {
+      error_step(s0, s1[2] - s0[2], dt, coeffs, s1);
+    }
+  }
+};
+
+// Prediction model of the MPC, the smoother and the latency predictor,
+// chosen at runtime, and the parameters of every model.
+struct ModelConfig {
+  enum Type { KINEMATIC, DYNAMIC };
+  Type type;
+  // Discretisation of the MPC transcription and the smoother
+  enum Integrator { EULER, HEUN, RUNGE_KUTTA };
+  Integrator integrator;
+
+  KinematicModel kinematic;
+  DynamicModel dynamic;
+
+  ModelConfig() : type(KINEMATIC), integrator(EULER) {}
+};
+
+// Calls f(model) with the model `config` selects. F has a templated
+// operator() and every instantiation is specialised for its model.
+template <typename F>
+void dispatch_model(const ModelConfig& config, F& f) {
+  if (config.type == ModelConfig::DYNAMIC) {
+    f(config.dynamic);
+  } else {
+    f(config.kinematic);
+  }
+}
+
+// Same, calling f(dynamics) with the model discretised by the integrator
+// `config` selects.
+template <typename F>
+struct DiscretizeThen {
+  ModelConfig::Integrator integrator;
+  F& f;
+
+  template <typename Model>
+  void operator()(const Model& model) const {
+    switch (integrator) {
+      case ModelConfig::EULER:
+        f(Discretized<Model, Euler>(model));
+        break;
+      case ModelConfig::HEUN:
+        f(Discretized<Model, Heun>(model));
+        break;
+      case ModelConfig::RUNGE_KUTTA:
+        f(Discretized<Model, RK4>(model));
+        break;
+    }
+  }
+};
+
+template <typename F>
+void dispatch_dynamics(const ModelConfig& config, F& f) {
+  DiscretizeThen<F> discretize = {config.integrator, f};
+  dispatch_model(config, discretize);
+}
+
+// Number of full state entries the selected model propagates
+size_t model_state_count(const ModelConfig& config);
+
+// Full state entry of the selected model's j-th state
+size_t model_state(const ModelConfig& config, size_t j);
+
+// Analytic Jacobians of the selected model (see the VehicleModel concept),
+// resized to its number of states.
+void model_jacobian(const ModelConfig& config, const double* s, double delta, double a,
+                    Eigen::MatrixXd& A, Eigen::MatrixXd& B);
+
+// Evaluates cte and epsi directly from (x, y, psi) and the path polynomial.
+template <typename Scalar>
+void path_errors(const Scalar& x, const Scalar& y, const Scalar& psi,
+                 const Eigen::Ref<const Eigen::VectorXd>& coeffs, Scalar& cte, Scalar& epsi) {
+  using std::atan;
+  Scalar fx = coeffs[0] + coeffs[1] * x + coeffs[2] * (x * x) + coeffs[3] * (x * x * x);
+  Scalar fprime_x = coeffs[1] + 2 * coeffs[2] * x + 3 * coeffs[3] * (x * x);
+  cte = fx - y;
+  epsi = psi - atan(fprime_x);
+}
+
+#endif /* VEHICLE_MODEL_H */
@@ -0,0 +1,130 @@
+#include "wire.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char kMagic[4] = {'M', 'P', 'C', 'B'};
+
+bool host_is_little_endian() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+}
+
+uint64_t swap64(uint64_t v) {
+  uint64_t r = 0;
+  for (int i = 0; i < 8; ++i) {
+    r = (r << 8) | (v & 0xff);
+    v >>= 8;
+  }
+  return r;
+}
+
+uint16_t get_u16(const char* p) {
+  return uint16_t(uint8_t(p[0])) | uint16_t(uint8_t(p[1])) << 8;
+}
+
+void put_u16(string& out, uint16_t v) {
+  out += char(v & 0xff);
+  out += char(v >> 8);
+}
+
+// Copies n doubles, byte swapping only on big-endian hosts
+void get_f64(const char* p, double* dst, size_t n) {
+  memcpy(dst, p, n * sizeof(double));
+  if (!host_is_little_endian()) {
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t bits;
+      memcpy(&bits, &dst[i], sizeof(bits));
+      bits = swap64(bits);
+      memcpy(&dst[i], &bits, sizeof(bits));
+    }
+  }
+}
+
+void put_f64(string& out, const double* src, size_t n) {
+  size_t pos = out.size();
+  out.resize(pos + n * sizeof(double));
+  char* p = &out[pos];
+  memcpy(p, src, n * sizeof(double));
+  if (!host_is_little_endian()) {
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t bits;
+      memcpy(&bits, p + i * sizeof(bits), sizeof(bits));
+      bits = swap64(bits);
+      memcpy(p + i * sizeof(bits), &bits, sizeof(bits));
+    }
+  }
+}
+
+void put_header(string& out, uint8_t type, uint16_t n0, uint16_t n1) {
+  out.append(kMagic, sizeof(kMagic));
+  out += char(kWireVersion);
+  out += char(type);
+  put_u16(out, n0);
+  put_u16(out, n1);
+  put_u16(out, 0);
+}
+
+}  // namespace
+
+bool wire_read_header(const char* data, size_t length, WireHeader& header) {
+  if (length < kWireHeaderSize || memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+    return false;
+  }
+  header.version = uint8_t(data[4]);
+  header.type = uint8_t(data[5]);
+  header.n0 = get_u16(data + 6);
+  header.n1 = get_u16(data + 8);
+  return header.version == kWireVersion;
+}
+
+bool wire_decode_telemetry(const char* data, size_t length, Telemetry& t) {
+  WireHeader header;
+  if (!wire_read_header(data, length, header) || header.type != WIRE_TELEMETRY) {
+    return false;
+  }
+  size_t n = header.n0;
+  if (n < kWireMinPoints || length != kWireHeaderSize + (6 + 2 * n) * sizeof(double)) {
+    return false;
+  }
+
+  const char* p = data + kWireHeaderSize;
+  double fields[6];
+  get_f64(p, fields, 6);
+  t.x = fields[0];
+  t.y = fields[1];
+  t.psi = fields[2];
+  t.speed = fields[3];
+  t.steering_angle = fields[4];
+  t.throttle = fields[5];
+  p += sizeof(fields);
+
+  t.ptsx.resize(n);
+  t.ptsy.resize(n);
+  if (n > 0) {
+    get_f64(p, t.ptsx.data(), n);
+    get_f64(p + n * sizeof(double), t.ptsy.data(), n);
+  }
+  return true;
+}
+
+void wire_encode_hello(string& out) {
+  out.clear();
+  put_header(out, WIRE_HELLO, 0, 0);
+}
+
+void wire_encode_steer(const SteerCommand& cmd, string& out) {
+  uint16_t n0 = uint16_t(min(cmd.mpc_x.size(), cmd.mpc_y.size()));
+  uint16_t n1 = uint16_t(min(cmd.next_x.size(), cmd.next_y.size()));
+
+  out.clear();
+  out.reserve(kWireHeaderSize + (2 + 2 * n0 + 2 * n1) * sizeof(double));
+  put_header(out, WIRE_STEER, n0, n1);
+  double fields[2] = {cmd.steering_angle, cmd.throttle};
+  put_f64(out, fields, 2);
+  put_f64(out, cmd.mpc_x.data(), n0);
+  put_f64(out, cmd.mpc_y.data(), n0);
+  put_f64(out, cmd.next_x.data(), n1);
+  put_f64(out, cmd.next_y.data(), n1);
+}
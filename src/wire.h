@@ -0,0 +1,82 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "span.h"
+
+using namespace std;
+
+// Vehicle telemetry as sent by the simulator, in map coordinates.
+// See DATA.md for the meaning and units of each field.
+struct Telemetry {
+  vector<double> ptsx;
+  vector<double> ptsy;
+  double x;
+  double y;
+  double psi;
+  double speed;
+  double steering_angle;
+  double throttle;
+};
+
+// Actuation sent back to the simulator, plus the trajectories it draws,
+// viewed in place until the command is sent.
+struct SteerCommand {
+  double steering_angle;
+  double throttle;
+  Span<double> mpc_x;
+  Span<double> mpc_y;
+  Span<double> next_x;
+  Span<double> next_y;
+};
+
+//
+// Binary framing for plant simulators that control both ends of the socket,
+// carried in WebSocket BINARY frames next to the JSON Socket.IO protocol.
+//
+// Every frame starts with a 12 byte header:
+//
+//   "MPCB" | version u8 | type u8 | n0 u16 | n1 u16 | reserved u16
+//
+// followed by packed little-endian IEEE-754 doubles:
+//
+//   HELLO      no body; the client sends it on connect and the server echoes
+//              it with its own version. The server only accepts binary
+//              telemetry on a connection after its HELLO.
+//   TELEMETRY  x, y, psi, speed, steering_angle, throttle, ptsx[n0], ptsy[n0],
+//              with at least kWireMinPoints waypoints
+//   STEER      steering_angle, throttle, mpc_x[n0], mpc_y[n0], next_x[n1], next_y[n1]
+//
+const uint8_t kWireVersion = 1;
+const size_t kWireHeaderSize = 12;
+// Fewest waypoints in a telemetry frame, enough for the cubic path fit
+const size_t kWireMinPoints = 4;
+
+enum WireType {
+  WIRE_HELLO = 1,
+  WIRE_TELEMETRY = 2,
+  WIRE_STEER = 3
+};
+
+struct WireHeader {
+  uint8_t version;
+  uint8_t type;
+  uint16_t n0;
+  uint16_t n1;
+};
+
+// Validates the magic and reads the header. Returns false if the frame is
+// not a binary MPC frame of a supported version.
+bool wire_read_header(const char* data, size_t length, WireHeader& header);
+
+// Returns false if the frame is truncated, not a telemetry frame or has
+// fewer than kWireMinPoints waypoints.
+bool wire_decode_telemetry(const char* data, size_t length, Telemetry& t);
+
+void wire_encode_hello(string& out);
+void wire_encode_steer(const SteerCommand& cmd, string& out);
+
+#endif /* WIRE_H */